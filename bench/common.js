@@ -0,0 +1,64 @@
+// Helpers shared by the benchmark scripts
+// SPDX-License-Identifier: MIT
+
+'use strict';
+
+const { execSync } = require('child_process');
+const crypto = require('crypto');
+const fs = require('fs');
+const net = require('net');
+const path = require('path');
+
+const ROOT = path.resolve(__dirname, '..');
+
+// Short hash of the commit checked out in dir, with -dirty if tracked files are modified
+function gitDescribe(dir = ROOT) {
+  try {
+    const commit = execSync('git rev-parse --short HEAD', { cwd: dir }).toString().trim();
+    const dirty = execSync('git status --porcelain --untracked-files=no', { cwd: dir }).toString().trim() !== '';
+    return commit + (dirty ? '-dirty' : '');
+  } catch (e) {
+    return 'unknown';
+  }
+}
+
+async function waitForPort(port) {
+  for (let i = 0; i < 100; i++) {
+    const open = await new Promise((resolve) => {
+      const socket = net.connect(port, '127.0.0.1', () => { socket.end(); resolve(true); });
+      socket.on('error', () => resolve(false));
+    });
+    if (open) {
+      return;
+    }
+    await new Promise((resolve) => setTimeout(resolve, 100));
+  }
+  throw new Error(`Nothing listening on port ${port}`);
+}
+
+function base64url(buffer) {
+  return buffer.toString('base64').replace(/=+$/, '').replace(/\+/g, '-').replace(/\//g, '_');
+}
+
+// HS256 JWT, as jsonwebtoken would sign it.
+function token(secret, userId) {
+  const header = base64url(Buffer.from(JSON.stringify({ alg: 'HS256', typ: 'JWT' })));
+  const payload = base64url(Buffer.from(JSON.stringify({ sub: userId, iat: Math.floor(Date.now() / 1000) })));
+  const signature = base64url(crypto.createHmac('sha256', secret).update(header + '.' + payload).digest());
+  return `${header}.${payload}.${signature}`;
+}
+
+function median(values) {
+  const sorted = values.slice().sort((a, b) => a - b);
+  const middle = sorted.length >> 1;
+  return sorted.length % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+}
+
+// Write a results file, e.g. results/<commit>.json, creating results/ if need be
+function writeResults(out, results) {
+  fs.mkdirSync(path.dirname(out), { recursive: true });
+  fs.writeFileSync(out, JSON.stringify(results, null, 2) + '\n');
+  console.log('Results written to ' + out);
+}
+
+module.exports = { ROOT, gitDescribe, waitForPort, base64url, token, median, writeResults };
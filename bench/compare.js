@@ -0,0 +1,38 @@
+// Compare two benchmark results from run.js (or the proxy scripts)
+// SPDX-License-Identifier: MIT
+//
+// Usage:
+//   node compare.js results/<before>.json results/<after>.json
+
+'use strict';
+
+const fs = require('fs');
+
+if (process.argv.length !== 4) {
+  console.error('Usage: node compare.js <before.json> <after.json>');
+  process.exit(1);
+}
+
+const [before, after] = process.argv.slice(2).map((file) => JSON.parse(fs.readFileSync(file, 'utf8')));
+
+// Medians over several runs, or the results of a single one
+const beforeMetrics = before.median || before.results;
+const afterMetrics = after.median || after.results;
+
+// Times are better lower, rates (per_s) better higher.
+const better = (name, change) => (/_per_s$/.test(name) ? change > 0 : change < 0);
+
+console.log(`${'metric'.padEnd(36)} ${before.commit.padStart(14)} ${after.commit.padStart(14)}   change`);
+for (const name of Object.keys({ ...beforeMetrics, ...afterMetrics })) {
+  const a = beforeMetrics[name];
+  const b = afterMetrics[name];
+  if (typeof a !== 'number' || typeof b !== 'number') {
+    console.log(`${name.padEnd(36)} ${String(a).padStart(14)} ${String(b).padStart(14)}`);
+    continue;
+  }
+
+  const change = a ? (b - a) / a * 100 : 0;
+  const mark = Math.abs(change) < 5 ? '' : better(name, change) ? '  better' : '  WORSE';
+  console.log(`${name.padEnd(36)} ${a.toFixed(1).padStart(14)} ${b.toFixed(1).padStart(14)}   ` +
+    `${(change >= 0 ? '+' : '') + change.toFixed(1)}%${mark}`);
+}
@@ -0,0 +1,34 @@
+// GC probe for proxy-gc.js
+// SPDX-License-Identifier: MIT
+//
+// Preloaded into the proxy (node --require gc-probe.js ws-proxy.js). Adds up the time spent in garbage collection
+// and the CPU time used, and writes them to GC_PROBE_OUT as JSON when the process is sent SIGTERM.
+
+'use strict';
+
+const fs = require('fs');
+const { PerformanceObserver, constants } = require('perf_hooks');
+
+const totals = { gc_ms: 0, gc_count: 0, gc_major_ms: 0, gc_minor_ms: 0 };
+
+new PerformanceObserver((list) => {
+  for (const entry of list.getEntries()) {
+    totals.gc_ms += entry.duration;
+    totals.gc_count++;
+    if (entry.detail && entry.detail.kind === constants.NODE_PERFORMANCE_GC_MAJOR) {
+      totals.gc_major_ms += entry.duration;
+    } else if (entry.detail && entry.detail.kind === constants.NODE_PERFORMANCE_GC_MINOR) {
+      totals.gc_minor_ms += entry.duration;
+    }
+  }
+}).observe({ entryTypes: ['gc'] });
+
+process.on('SIGTERM', () => {
+  const cpu = process.cpuUsage();
+  fs.writeFileSync(process.env.GC_PROBE_OUT, JSON.stringify({
+    ...totals,
+    cpu_ms: (cpu.user + cpu.system) / 1000,
+    max_rss_mb: process.resourceUsage().maxRSS / 1024,
+  }));
+  process.exit(0);
+});
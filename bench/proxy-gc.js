@@ -0,0 +1,250 @@
+// Garbage collection in server/ws-proxy.js's relay
+// SPDX-License-Identifier: MIT
+//
+// Starts the proxy (test-proxy.js) against a local bulk server with gc-probe.js preloaded, and relays bulk data
+// both ways: each guest connection writes --up bytes and the upstream sends it --down bytes. Measures the time the
+// proxy spends in GC and its CPU time per relayed MB, and writes the medians over --runs to a JSON file like run.js
+// does.
+//
+// Usage:
+//   node proxy-gc.js [--runs N] [--users N] [--conns N] [--up N] [--down N] [--writes binary|json]
+//                    [--server DIR] [--out FILE]
+//
+// Guests are one JWT user each, so keep --conns * (--up + --down) within a user's 10 MB burst. --writes json sends
+// guest data as {t: 'write', b64} messages, which older proxies need; --server runs the proxy from another checkout
+// (e.g. a git worktree of an older commit) to compare, through this checkout's test-proxy.js, so it has to be one
+// whose WSProxyServer takes a dnsResolver and connector.
+
+'use strict';
+
+const WebSocket = require('ws');
+const { spawn } = require('child_process');
+const crypto = require('crypto');
+const fs = require('fs');
+const net = require('net');
+const os = require('os');
+const path = require('path');
+
+const { ROOT, gitDescribe, waitForPort, token, median, writeResults } = require('./common.js');
+
+const PROXY_PORT = 18081;
+const JWT_SECRET = crypto.randomBytes(32).toString('hex');
+
+const CHUNK = 16384;
+
+function parseArgs(argv) {
+  const args = {
+    runs: 3, users: 64, conns: 2, up: 1 << 20, down: 3 << 20, writes: 'binary', server: path.join(ROOT, 'server'),
+    out: null,
+  };
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--runs': args.runs = parseInt(value, 10); i++; break;
+      case '--users': args.users = parseInt(value, 10); i++; break;
+      case '--conns': args.conns = parseInt(value, 10); i++; break;
+      case '--up': args.up = parseInt(value, 10); i++; break;
+      case '--down': args.down = parseInt(value, 10); i++; break;
+      case '--writes': args.writes = value; i++; break;
+      case '--server': args.server = path.resolve(value); i++; break;
+      case '--out': args.out = value; i++; break;
+      default:
+        console.error('Usage: node proxy-gc.js [--runs N] [--users N] [--conns N] [--up N] [--down N] ' +
+          '[--writes binary|json] [--server DIR] [--out FILE]');
+        process.exit(1);
+    }
+  }
+  return args;
+}
+
+// Sends each connection down bytes (as fast as it takes them) and counts what it receives
+function startBulkServer(down) {
+  const bulk = { received: 0 };
+  const block = crypto.randomBytes(64 * 1024);
+  bulk.server = net.createServer((socket) => {
+    socket.on('data', (data) => { bulk.received += data.length; });
+    socket.on('error', () => {});
+
+    let sent = 0;
+    const send = () => {
+      while (sent < down) {
+        const n = Math.min(block.length, down - sent);
+        sent += n;
+        if (!socket.write(n === block.length ? block : block.subarray(0, n))) {
+          socket.once('drain', send);
+          return;
+        }
+      }
+    };
+    send();
+  });
+  return new Promise((resolve) => bulk.server.listen({ port: 0, host: '127.0.0.1', backlog: 4096 }, () => resolve(bulk)));
+}
+
+/**
+ * One guest: a WebSocket with a few connections, each writing up bytes and reading down bytes
+ * @returns {Promise<{received: number, errors: string[]}>}
+ */
+function guest(userId, args, payload) {
+  return new Promise((resolve) => {
+    const ws = new WebSocket(`ws://127.0.0.1:${PROXY_PORT}/?token=${token(JWT_SECRET, userId)}`);
+    const result = { received: 0, errors: [] };
+    const received = new Map();
+    let finished = 0;
+
+    const finish = () => {
+      if (++finished === args.conns) {
+        ws.close();
+        resolve(result);
+      }
+    };
+    const count = (id, bytes) => {
+      result.received += bytes;
+      received.set(id, received.get(id) + bytes);
+      if (received.get(id) === args.down) {
+        ws.send(JSON.stringify({ t: 'close', id }));
+        finish();
+      }
+    };
+
+    ws.on('open', () => {
+      for (let id = 1; id <= args.conns; id++) {
+        received.set(id, 0);
+        ws.send(JSON.stringify({ t: 'open', id, host: 'example.com', port: 80 }));
+      }
+    });
+
+    ws.on('message', (data, isBinary) => {
+      if (isBinary) {
+        count(data.readUInt32BE(0), data.length - 4);
+        return;
+      }
+      const msg = JSON.parse(data.toString());
+      if (msg.t === 'opened') {
+        const header = Buffer.alloc(4);
+        header.writeUInt32BE(msg.id);
+        const frame = args.writes === 'json'
+          ? JSON.stringify({ t: 'write', id: msg.id, b64: payload.toString('base64') })
+          : Buffer.concat([header, payload]);
+        for (let sent = 0; sent < args.up; sent += CHUNK) {
+          ws.send(frame);
+        }
+      } else if (msg.t === 'data') {
+        count(msg.id, Buffer.from(msg.b64, 'base64').length);
+      } else if (msg.t === 'error') {
+        result.errors.push(msg.msg);
+        if (msg.id) {
+          finish();
+        }
+      }
+    });
+
+    ws.on('error', (err) => result.errors.push(err.message));
+    ws.on('close', () => {
+      if (finished < args.conns) {
+        result.errors.push('WebSocket closed early');
+      }
+      resolve(result);
+    });
+  });
+}
+
+async function run(args) {
+  const bulk = await startBulkServer(args.down);
+  const probeOut = path.join(os.tmpdir(), `proxy-gc-${process.pid}.json`);
+
+  const proxy = spawn('node', [
+    '--require', path.join(__dirname, 'gc-probe.js'),
+    path.join(__dirname, 'test-proxy.js'), `127.0.0.1:${bulk.server.address().port}`, args.server,
+  ], {
+    cwd: args.server,
+    stdio: ['ignore', 'ignore', 'inherit'],
+    env: {
+      ...process.env,
+      PORT: String(PROXY_PORT),
+      JWT_SECRET: JWT_SECRET,
+      CLUSTER_WORKERS: '0',
+      LOG_SAMPLE_RATE: '0',
+      GC_PROBE_OUT: probeOut,
+    },
+  });
+  const exited = new Promise((resolve) => proxy.on('exit', resolve));
+
+  try {
+    await waitForPort(PROXY_PORT);
+
+    const payload = crypto.randomBytes(CHUNK);
+    const expectedUp = args.users * args.conns * Math.ceil(args.up / CHUNK) * CHUNK;
+    const start = Date.now();
+    const all = await Promise.all(Array.from({ length: args.users }, (_, i) => guest(`gc-${i}`, args, payload)));
+
+    // Closing can overtake the last writes reaching the upstream.
+    while (bulk.received < expectedUp && Date.now() - start < 60000) {
+      await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+    const seconds = (Date.now() - start) / 1000;
+
+    proxy.kill('SIGTERM');
+    await exited;
+    const probe = JSON.parse(fs.readFileSync(probeOut, 'utf8'));
+    fs.unlinkSync(probeOut);
+
+    const errors = all.flatMap((r) => r.errors);
+    const relayedMb = (bulk.received + all.reduce((total, r) => total + r.received, 0)) / (1 << 20);
+    return {
+      relayed_mb: relayedMb,
+      relay_mb_per_s: relayedMb / seconds,
+      gc_ms: probe.gc_ms,
+      gc_count: probe.gc_count,
+      gc_major_ms: probe.gc_major_ms,
+      gc_minor_ms: probe.gc_minor_ms,
+      gc_ms_per_mb: probe.gc_ms / relayedMb,
+      cpu_ms_per_mb: probe.cpu_ms / relayedMb,
+      max_rss_mb: probe.max_rss_mb,
+      complete: bulk.received >= expectedUp && errors.length === 0,
+      errors: errors.length,
+      first_errors: [...new Set(errors)].slice(0, 5),
+    };
+  } finally {
+    proxy.kill();
+    bulk.server.close();
+  }
+}
+
+async function main() {
+  const args = parseArgs(process.argv);
+
+  const runs = [];
+  for (let i = 0; i < args.runs; i++) {
+    runs.push(await run(args));
+    console.log(`Run ${i + 1}/${args.runs}: ` + JSON.stringify(runs[i]));
+  }
+
+  const summary = {};
+  for (const [name, value] of Object.entries(runs[0])) {
+    if (typeof value === 'number') {
+      summary[name] = median(runs.map((r) => r[name]));
+    }
+  }
+  summary.complete = runs.every((r) => r.complete);
+
+  const commit = gitDescribe(args.server);
+  const out = args.out || path.join(__dirname, 'results', `proxy-gc-${commit}-${args.writes}.json`);
+  console.log(JSON.stringify(summary, null, 2));
+  writeResults(out, {
+    commit: commit,
+    date: new Date().toISOString(),
+    users: args.users,
+    conns: args.conns,
+    up: args.up,
+    down: args.down,
+    writes: args.writes,
+    median: summary,
+    runs: runs,
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,199 @@
+// Load test for server/ws-proxy.js
+// SPDX-License-Identifier: MIT
+//
+// Starts the proxy (test-proxy.js) against a local TCP sink and
+// simulates many guests: one WebSocket per user (each with its own JWT, so
+// per-user rate limits apply as in production), each opening a few guest
+// connections and writing through them. Measures open latency and relay
+// throughput, and writes the results to a JSON file like run.js does.
+//
+// Usage:
+//   node proxy-load.js [--workers N|auto] [--users N] [--conns N] [--bytes N] [--out FILE]
+//
+// --workers is CLUSTER_WORKERS for the proxy (0 runs it in one process).
+
+'use strict';
+
+const WebSocket = require('ws');
+const { spawn } = require('child_process');
+const crypto = require('crypto');
+const net = require('net');
+const path = require('path');
+
+const { ROOT, gitDescribe, waitForPort, token, writeResults } = require('./common.js');
+
+const PROXY_PORT = 18080;
+const JWT_SECRET = crypto.randomBytes(32).toString('hex');
+
+const CHUNK = 4096;
+const CONNECTING = 200;  // WebSockets being opened at a time, to stay under the listen backlog
+
+function parseArgs(argv) {
+  const args = { workers: '0', users: 1000, conns: 4, bytes: 16384, out: null };
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--workers': args.workers = value; i++; break;
+      case '--users': args.users = parseInt(value, 10); i++; break;
+      case '--conns': args.conns = parseInt(value, 10); i++; break;
+      case '--bytes': args.bytes = parseInt(value, 10); i++; break;
+      case '--out': args.out = value; i++; break;
+      default:
+        console.error('Usage: node proxy-load.js [--workers N|auto] [--users N] [--conns N] [--bytes N] [--out FILE]');
+        process.exit(1);
+    }
+  }
+  return args;
+}
+
+function startSink() {
+  const sink = { received: 0, connections: 0 };
+  sink.server = net.createServer((socket) => {
+    sink.connections++;
+    socket.on('data', (data) => { sink.received += data.length; });
+    socket.on('error', () => {});
+  });
+  return new Promise((resolve) => sink.server.listen({ port: 0, host: '127.0.0.1', backlog: 4096 }, () => resolve(sink)));
+}
+
+function percentile(values, p) {
+  const sorted = values.slice().sort((a, b) => a - b);
+  return sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))] : null;
+}
+
+/**
+ * One guest: a WebSocket with a few connections, each writing its share of bytes
+ * @returns {Promise<{openMs: number[], errors: string[]}>}
+ */
+function guest(userId, args, payload) {
+  return new Promise((resolve) => {
+    const ws = new WebSocket(`ws://127.0.0.1:${PROXY_PORT}/?token=${token(JWT_SECRET, userId)}`);
+    const result = { openMs: [], errors: [] };
+    const opening = new Map();
+    let finished = 0;
+
+    const finish = () => {
+      if (++finished === args.conns) {
+        ws.close();
+        resolve(result);
+      }
+    };
+
+    ws.on('open', () => {
+      for (let id = 1; id <= args.conns; id++) {
+        opening.set(id, Date.now());
+        ws.send(JSON.stringify({ t: 'open', id, host: 'example.com', port: 80 }));
+      }
+    });
+
+    ws.on('message', (data) => {
+      const msg = JSON.parse(data.toString());
+      if (msg.t === 'opened') {
+        result.openMs.push(Date.now() - opening.get(msg.id));
+        for (let sent = 0; sent < args.bytes; sent += CHUNK) {
+          ws.send(JSON.stringify({ t: 'write', id: msg.id, b64: payload }));
+        }
+        ws.send(JSON.stringify({ t: 'close', id: msg.id }));
+      } else if (msg.t === 'closed') {
+        finish();
+      } else if (msg.t === 'error') {
+        result.errors.push(msg.msg);
+        if (msg.id) {
+          finish();
+        }
+      }
+    });
+
+    ws.on('error', (err) => result.errors.push(err.message));
+    ws.on('close', (code, reason) => {
+      if (finished < args.conns) {
+        result.errors.push(`WebSocket closed (${code} ${reason})`);
+      }
+      resolve(result);
+    });
+  });
+}
+
+async function main() {
+  const args = parseArgs(process.argv);
+  const sink = await startSink();
+
+  const proxy = spawn('node', [path.join(__dirname, 'test-proxy.js'), `127.0.0.1:${sink.server.address().port}`], {
+    cwd: path.join(ROOT, 'server'),
+    stdio: ['ignore', 'ignore', 'inherit'],
+    env: {
+      ...process.env,
+      PORT: String(PROXY_PORT),
+      JWT_SECRET: JWT_SECRET,
+      CLUSTER_WORKERS: args.workers,
+    },
+  });
+
+  let results;
+  try {
+    await waitForPort(PROXY_PORT);
+
+    const payload = crypto.randomBytes(CHUNK).toString('base64');
+    const expected = args.users * args.conns * Math.ceil(args.bytes / CHUNK) * CHUNK;
+    const guests = [];
+    const start = Date.now();
+
+    // Keep CONNECTING guests starting at a time, the rest wait their turn.
+    let next = 0;
+    const startNext = () => {
+      if (next < args.users) {
+        const promise = guest(`load-${next++}`, args, payload);
+        guests.push(promise);
+        promise.then(startNext);
+      }
+    };
+    for (let i = 0; i < CONNECTING; i++) {
+      startNext();
+    }
+    while (guests.length < args.users) {
+      await Promise.all(guests);
+    }
+    const all = await Promise.all(guests);
+
+    // Closing can overtake the last writes reaching the sink.
+    while (sink.received < expected && Date.now() - start < 60000) {
+      await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+    const seconds = (Date.now() - start) / 1000;
+
+    const openMs = all.flatMap((r) => r.openMs);
+    const errors = all.flatMap((r) => r.errors);
+    results = {
+      connections: openMs.length,
+      connections_per_s: openMs.length / seconds,
+      open_ms_p50: percentile(openMs, 0.5),
+      open_ms_p99: percentile(openMs, 0.99),
+      relayed_mb: sink.received / (1 << 20),
+      relay_mb_per_s: sink.received / (1 << 20) / seconds,
+      complete: sink.received >= expected,
+      errors: errors.length,
+      first_errors: [...new Set(errors)].slice(0, 5),
+    };
+  } finally {
+    proxy.kill();
+    sink.server.close();
+  }
+
+  const commit = gitDescribe();
+  const out = args.out || path.join(__dirname, 'results', `proxy-load-${commit}-w${args.workers}.json`);
+  console.log(JSON.stringify(results, null, 2));
+  writeResults(out, {
+    commit: commit,
+    date: new Date().toISOString(),
+    workers: args.workers,
+    users: args.users,
+    conns: args.conns,
+    bytes: args.bytes,
+    results: results,
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
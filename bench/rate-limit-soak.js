@@ -0,0 +1,168 @@
+// Soak test for the per-user state in server/ws-proxy.js
+// SPDX-License-Identifier: MIT
+//
+// Runs the proxy's RateLimiter and DNSResolver in this process and pushes a
+// stream of distinct users through them, the way a long-running instance
+// sees anonymous users come and go: each opens a few connections, moves some
+// bytes, resolves a hostname of its own and leaves. Samples the state sizes
+// and heap once a second, then waits for the expiry to forget everyone. Fails
+// if state is left behind or the DNS cache outgrows its bound.
+//
+// Usage:
+//   node --expose-gc rate-limit-soak.js [--users N] [--seconds N] [--out FILE]
+//
+// --users distinct users (default 1000000) arrive evenly over --seconds
+// (default 60). Without --expose-gc, heap samples include garbage.
+
+'use strict';
+
+const dns = require('dns').promises;
+const path = require('path');
+
+const { CONFIG, IPValidator, RateLimiter, DNSResolver } = require('../server/ws-proxy.js');
+const { gitDescribe, writeResults } = require('./common.js');
+
+const CONNS = 3;                  // Connections per user
+const MAX_BYTES = 1024 * 1024;    // Bytes per user, at most
+const DNS_TTL = 5;                // Seconds, what the stand-in DNS answers with
+const DRAIN_TIMEOUT = 90000;      // After the last arrival, for state to go
+
+function parseArgs(argv) {
+  const args = { users: 1000000, seconds: 60, out: null };
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--users': args.users = parseInt(value, 10); i++; break;
+      case '--seconds': args.seconds = parseInt(value, 10); i++; break;
+      case '--out': args.out = value; i++; break;
+      default:
+        console.error('Usage: node --expose-gc rate-limit-soak.js [--users N] [--seconds N] [--out FILE]');
+        process.exit(1);
+    }
+  }
+  return args;
+}
+
+function heapMb() {
+  if (global.gc) {
+    global.gc();
+  }
+  return process.memoryUsage().heapUsed / (1 << 20);
+}
+
+// One user's visit
+async function visit(rateLimiter, dnsResolver, userId, bytes) {
+  await dnsResolver.resolveAndValidate(`${userId}.example.com`);
+  for (let i = 0; i < CONNS; i++) {
+    if (!rateLimiter.reserveConnection(userId).allowed) {
+      return false;
+    }
+    const share = Math.floor(bytes / CONNS);
+    if (rateLimiter.canTransfer(userId, share).allowed) {
+      rateLimiter.recordBytes(userId, share);
+    }
+    rateLimiter.recordDisconnection(userId);
+  }
+  return true;
+}
+
+async function main() {
+  const args = parseArgs(process.argv);
+
+  // Stand-in DNS, a public address per name
+  dns.resolve4 = async () => [{ address: '93.184.216.34', ttl: DNS_TTL }];
+  dns.resolve6 = async () => [];
+
+  const rateLimiter = new RateLimiter(CONFIG.rateLimits);
+  const dnsResolver = new DNSResolver(CONFIG.dnsCache, new IPValidator(CONFIG.blockedCIDRs));
+
+  const samples = [];
+  const start = Date.now();
+  let arrived = 0;
+  let refused = 0;
+  let opsMs = 0;
+  const sample = () => {
+    samples.push({
+      s: Math.round((Date.now() - start) / 1000),
+      arrived,
+      ...rateLimiter.metrics(),
+      dns_entries: dnsResolver.metrics().entries,
+      heap_mb: Math.round(heapMb() * 10) / 10,
+    });
+    const last = samples[samples.length - 1];
+    console.log(`${last.s}s: ${last.arrived} arrived, ${last.users} users tracked, ` +
+      `${last.dns_entries} DNS entries, ${last.heap_mb} MB heap`);
+  };
+
+  const baselineMb = heapMb();
+  const sampler = setInterval(sample, 1000);
+
+  // Arrivals in 10 ms batches, yielding in between so the expiry timers run
+  const perBatch = Math.ceil(args.users / (args.seconds * 100));
+  while (arrived < args.users) {
+    const batchStart = Date.now();
+    const batch = [];
+    for (let i = 0; i < perBatch && arrived < args.users; i++, arrived++) {
+      batch.push(visit(rateLimiter, dnsResolver, `soak-${arrived}`, Math.floor(Math.random() * MAX_BYTES)));
+    }
+    refused += (await Promise.all(batch)).filter((ok) => !ok).length;
+    opsMs += Date.now() - batchStart;
+    await new Promise((resolve) => setTimeout(resolve, Math.max(0, 10 - (Date.now() - batchStart))));
+  }
+  const arrivalSeconds = (Date.now() - start) / 1000;
+
+  // Every user has left, expiry should now forget them all (and their DNS answers) within about a minute.
+  const drainStart = Date.now();
+  while ((rateLimiter.metrics().users > 0 || dnsResolver.metrics().entries > 0) && Date.now() - drainStart < DRAIN_TIMEOUT) {
+    await new Promise((resolve) => setTimeout(resolve, 100));
+  }
+  const drainSeconds = (Date.now() - drainStart) / 1000;
+  clearInterval(sampler);
+  sample();
+
+  const final = samples[samples.length - 1];
+  const results = {
+    users: args.users,
+    refused: refused,
+    arrival_s: arrivalSeconds,
+    users_per_s: args.users / arrivalSeconds,
+    limiter_us_per_user: opsMs * 1000 / args.users,
+    peak_users_tracked: Math.max(...samples.map((s) => s.users)),
+    peak_dns_entries: Math.max(...samples.map((s) => s.dns_entries)),
+    peak_heap_mb: Math.max(...samples.map((s) => s.heap_mb)),
+    baseline_heap_mb: baselineMb,
+    final_users_tracked: final.users,
+    final_heap_mb: final.heap_mb,
+    drain_s: drainSeconds,
+  };
+
+  const commit = gitDescribe();
+  const out = args.out || path.join(__dirname, 'results', `rate-limit-soak-${commit}.json`);
+  console.log(JSON.stringify(results, null, 2));
+  writeResults(out, {
+    commit: commit,
+    date: new Date().toISOString(),
+    results: results,
+    samples: samples,
+  });
+
+  const failures = [];
+  if (final.users !== 0 || final.expiring !== 0) {
+    failures.push(`${final.users} users still tracked after ${drainSeconds}s`);
+  }
+  if (final.dns_entries !== 0) {
+    failures.push(`${final.dns_entries} DNS entries left after ${drainSeconds}s`);
+  }
+  if (results.peak_dns_entries > CONFIG.dnsCache.maxEntries) {
+    failures.push(`DNS cache reached ${results.peak_dns_entries} entries, bound is ${CONFIG.dnsCache.maxEntries}`);
+  }
+  if (failures.length) {
+    console.error('FAIL: ' + failures.join(', '));
+    process.exit(1);
+  }
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
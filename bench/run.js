@@ -0,0 +1,276 @@
+// Headless benchmark runner for Linux/Wasm
+// SPDX-License-Identifier: MIT
+//
+// Serves site/ with site/server.py, runs server/ws-proxy.js against a local
+// TCP echo server (test-proxy.js, so nothing leaves the machine) and drives the
+// page in headless Chromium through its ?bench=1 hook. Measures boot-to-prompt
+// (cold and warm), whatever the guest side (lwbench) measures, fs-persist save
+// and load rates and package restore time. Results go to a JSON file named
+// after the commit, for compare.js.
+//
+// Usage:
+//   node run.js [--runs N] [--scale N] [--vmlinux URL] [--out FILE]
+//
+// --vmlinux is relative to site/ (e.g. vmlinux.wasm for a local build), the
+// default is the one the site boots.
+
+'use strict';
+
+const { chromium } = require('playwright');
+const { spawn } = require('child_process');
+const net = require('net');
+const path = require('path');
+
+const { ROOT, gitDescribe, waitForPort, median, writeResults } = require('./common.js');
+
+const SITE_PORT = 8000;
+const PROXY_PORT = 8080;  // Where the page looks for the proxy when served from localhost
+
+const BOOT_TIMEOUT = 300000;
+const COMMAND_TIMEOUT = 600000;
+
+// =============================================================================
+// Setup
+// =============================================================================
+
+function parseArgs(argv) {
+  const args = { runs: 3, scale: 1, vmlinux: null, out: null };
+  for (let i = 2; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--runs': args.runs = parseInt(value, 10); i++; break;
+      case '--scale': args.scale = parseInt(value, 10); i++; break;
+      case '--vmlinux': args.vmlinux = value; i++; break;
+      case '--out': args.out = value; i++; break;
+      default:
+        console.error('Usage: node run.js [--runs N] [--scale N] [--vmlinux URL] [--out FILE]');
+        process.exit(1);
+    }
+  }
+  return args;
+}
+
+function startEchoServer() {
+  return new Promise((resolve) => {
+    const server = net.createServer((socket) => {
+      socket.on('error', () => {});
+      socket.pipe(socket);
+    });
+    server.listen(0, '127.0.0.1', () => resolve(server));
+  });
+}
+
+function startProcess(command, args, options) {
+  const child = spawn(command, args, { stdio: ['ignore', 'ignore', 'inherit'], ...options });
+  child.on('exit', (code) => {
+    if (code !== null && code !== 0) {
+      console.error(`${command} exited with ${code}`);
+    }
+  });
+  return child;
+}
+
+// =============================================================================
+// Page helpers
+// =============================================================================
+
+/**
+ * Wait for the console to print something after an offset
+ * @returns {Promise<string>} Console output from the offset on
+ */
+async function waitForOutput(page, offset, pattern, timeout) {
+  await page.waitForFunction(([offset, source]) => {
+    const bench = window.linux_wasm_bench;
+    return bench && new RegExp(source).test(bench.output.slice(offset));
+  }, [offset, pattern.source], { timeout: timeout, polling: 50 });
+  return page.evaluate((offset) => window.linux_wasm_bench.output.slice(offset), offset);
+}
+
+async function outputLength(page) {
+  return page.evaluate(() => window.linux_wasm_bench.output.length);
+}
+
+// The shell prompt, after the /init banner.
+const PROMPT = /busybox --list[\s\S]*[#$] $/;
+
+async function boot(page, url) {
+  await page.goto(url);
+  await waitForOutput(page, 0, PROMPT, BOOT_TIMEOUT);
+
+  return page.evaluate(() => {
+    const bench = window.linux_wasm_bench;
+    return {
+      kind: bench.boot_kind,
+      prompt_ms: performance.now(),
+      compile_ms: bench.compile_ms,
+      phases: bench.boot_phases,
+    };
+  });
+}
+
+/**
+ * Run a shell command in the guest
+ * @returns {Promise<{output: string, ms: number}>}
+ */
+async function run(page, command, done) {
+  await page.waitForFunction(() => window.linux_wasm_bench.os !== null, null, { timeout: BOOT_TIMEOUT });
+
+  const offset = await outputLength(page);
+  const start = Date.now();
+  await page.evaluate((command) => window.linux_wasm_bench.os.key_input(command + '\n'), command);
+  const output = await waitForOutput(page, offset, done, COMMAND_TIMEOUT);
+  return { output: output, ms: Date.now() - start };
+}
+
+async function guestBenchmarks(page, scale) {
+  // The proxy sends the connection to the echo server whatever host it names (port 80 is allowed by the proxy).
+  const { output } = await run(page, `lwbench ${scale} net example.com 80`, /LWBENCH \{.*\}/);
+  return JSON.parse(output.match(/LWBENCH (\{.*\})/)[1]);
+}
+
+async function fsPersistBenchmarks(page, scale) {
+  return page.evaluate(async (scale) => {
+    const fsPersist = window.linux_wasm_bench.os.getFsPersist();
+    if (!fsPersist) {
+      return null;
+    }
+
+    const results = {};
+    const measure = async (name, count, size, operation) => {
+      const start = performance.now();
+      for (let i = 0; i < count; i++) {
+        await operation(i);
+      }
+      const seconds = (performance.now() - start) / 1000;
+      results[name + '_files_per_s'] = count / seconds;
+      results[name + '_mb_per_s'] = count * size / (1 << 20) / seconds;
+    };
+
+    // Many small files (dotfiles, sources) and a few big ones (databases, binaries).
+    for (const [label, count, size] of [['small', 200 * scale, 4096], ['large', 4 * scale, 4 << 20]]) {
+      const content = new Uint8Array(size).fill(0x5a);
+      await measure('save_' + label, count, size, (i) => fsPersist.saveFile(`/home/lwbench/${label}${i}`, content));
+      await measure('load_' + label, count, size, (i) => fsPersist.loadFile(`/home/lwbench/${label}${i}`));
+      for (let i = 0; i < count; i++) {
+        await fsPersist.deleteFile(`/home/lwbench/${label}${i}`);
+      }
+    }
+    return results;
+  }, scale);
+}
+
+async function packageRestoreBenchmark(page) {
+  // What the pkg_restore callback in linux.js does for a cached package: load it from IndexedDB and copy it out.
+  return page.evaluate(async () => {
+    const fsPersist = window.linux_wasm_bench.os.getFsPersist();
+    if (!fsPersist) {
+      return null;
+    }
+
+    const pkg = '/opt/pkg/lwbench.wasm';
+    const size = 8 << 20;
+    await fsPersist.saveFile(pkg, new Uint8Array(size).fill(0x61), { mode: 0o755 });
+
+    const start = performance.now();
+    const file = await fsPersist.loadFile(pkg);
+    new Uint8Array(file.content.length).set(file.content);
+    const ms = performance.now() - start;
+
+    await fsPersist.deleteFile(pkg);
+    return { pkg_restore_ms: ms, pkg_restore_mb: size / (1 << 20) };
+  });
+}
+
+// =============================================================================
+// Main
+// =============================================================================
+
+// Flatten a run into metric -> value.
+function metrics(run) {
+  const flat = {};
+  for (const kind of ['cold', 'warm']) {
+    flat[`boot_${kind}_prompt_ms`] = run.boot[kind].prompt_ms;
+    flat[`boot_${kind}_compile_ms`] = run.boot[kind].compile_ms;
+    for (const [phase, ms] of Object.entries(run.boot[kind].phases || {})) {
+      flat[`boot_${kind}_${phase}_ms`] = ms;
+    }
+  }
+  Object.assign(flat, run.guest, run.fs_persist, run.pkg);
+  return flat;
+}
+
+async function main() {
+  const args = parseArgs(process.argv);
+  const commit = gitDescribe();
+
+  const echo = await startEchoServer();
+  const children = [
+    startProcess('python3', ['server.py', String(SITE_PORT)], { cwd: path.join(ROOT, 'site') }),
+    startProcess('node', [path.join(__dirname, 'test-proxy.js'), `127.0.0.1:${echo.address().port}`], {
+      cwd: path.join(ROOT, 'server'),
+      env: {
+        ...process.env,
+        PORT: String(PROXY_PORT),
+        AUTH_ENABLED: 'false',
+      },
+    }),
+  ];
+
+  const browser = await chromium.launch();
+  const browserVersion = browser.version();
+  const runs = [];
+  try {
+    await Promise.all([waitForPort(SITE_PORT), waitForPort(PROXY_PORT)]);
+
+    // localhost (not 127.0.0.1), or the page does not use the local proxy.
+    const url = `http://localhost:${SITE_PORT}/?bench=1` +
+      (args.vmlinux ? '&vmlinux=' + encodeURIComponent(args.vmlinux) : '');
+
+    for (let i = 0; i < args.runs; i++) {
+      // A fresh context has empty caches, so the first boot is cold. The reload boots from the cached vmlinux and
+      // the boot snapshot, once /init has handed it over.
+      const context = await browser.newContext();
+      const page = await context.newPage();
+
+      const result = { boot: {} };
+      result.boot.cold = await boot(page, url);
+      await run(page, 'while [ ! -f /etc/lw-snapshot ]; do sleep 1; done; echo SNAPSHOT_DONE',
+        /\nSNAPSHOT_DONE/);
+      result.boot.warm = await boot(page, url);
+
+      result.guest = await guestBenchmarks(page, args.scale);
+      result.fs_persist = await fsPersistBenchmarks(page, args.scale);
+      result.pkg = await packageRestoreBenchmark(page);
+
+      await context.close();
+      runs.push(result);
+      console.log(`Run ${i + 1}/${args.runs}: ` + JSON.stringify(metrics(result)));
+    }
+  } finally {
+    await browser.close();
+    children.forEach((child) => child.kill());
+    echo.close();
+  }
+
+  const summary = {};
+  const all = runs.map(metrics);
+  for (const name of Object.keys(all[0])) {
+    summary[name] = median(all.map((m) => m[name]).filter((value) => typeof value === 'number'));
+  }
+
+  const out = args.out || path.join(__dirname, 'results', `${commit}.json`);
+  writeResults(out, {
+    commit: commit,
+    date: new Date().toISOString(),
+    vmlinux: args.vmlinux,
+    scale: args.scale,
+    browser: browserVersion,
+    median: summary,
+    runs: runs,
+  });
+}
+
+main().catch((err) => {
+  console.error(err);
+  process.exit(1);
+});
@@ -0,0 +1,56 @@
+// server/ws-proxy.js with a local stand-in for the internet
+// SPDX-License-Identifier: MIT
+//
+// Runs the proxy the way `node ws-proxy.js` does (same environment variables, CLUSTER_WORKERS included), except that
+// every connection goes to one local host:port instead of where the guest asked for, so nothing leaves the machine.
+// The port allowlist and rate limits still apply. The stand-in is plain TCP, so guests should use port 80.
+//
+// Usage:
+//   node test-proxy.js HOST:PORT [SERVER_DIR]
+//
+// SERVER_DIR is the server/ to run, e.g. of a git worktree of another commit (default: this checkout's).
+
+'use strict';
+
+const cluster = require('cluster');
+const path = require('path');
+
+const [upstream, serverDir] = process.argv.slice(2);
+if (!/^[^:]+:\d+$/.test(upstream || '')) {
+  console.error('Usage: node test-proxy.js HOST:PORT [SERVER_DIR]');
+  process.exit(1);
+}
+const [host, port] = upstream.split(':');
+
+const {
+  CONFIG, IPValidator, DNSResolver, Connector, WSProxyServer, startCluster,
+} = require(path.resolve(serverDir || path.join(__dirname, '..', 'server'), 'ws-proxy.js'));
+
+// Every name resolves to the stand-in, unchecked
+class StandInResolver extends DNSResolver {
+  async resolveAndValidate() {
+    return { ip: host, addresses: [host] };
+  }
+}
+
+// Every connection goes to the stand-in, without TLS
+class StandInConnector extends Connector {
+  connect() {
+    return super.connect([host], parseInt(port, 10), null);
+  }
+}
+
+if (cluster.isPrimary) {
+  console.warn(`Every connection goes to ${upstream}\n`);
+}
+
+// Workers run this script too, and get the stand-ins here
+if (cluster.isPrimary && CONFIG.cluster.workers > 0) {
+  startCluster(CONFIG);
+} else {
+  const server = new WSProxyServer(CONFIG, {
+    dnsResolver: new StandInResolver(CONFIG.dnsCache, new IPValidator(CONFIG.blockedCIDRs)),
+    connector: new StandInConnector(CONFIG.connect, CONFIG.rateLimits.connectionTimeout),
+  });
+  server.start();
+}
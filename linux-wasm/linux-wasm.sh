@@ -92,12 +92,25 @@ case "$1" in # note use of ;;& meaning that each case is re-tested (can hit mult
         git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0011-Add-wasm_defconfig.patch"
         git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0012-HACK-Workaround-broken-wq_worker_comm.patch"
         git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0015-Add-Wasm-network-support.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0016-Add-Wasm-vDSO-data-page.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0017-Round-Wasm-timer-expiries-to-a-slack-and-count-wakeups.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0018-Add-a-scalable-Wasm-interrupt-controller.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0019-Coalesce-Wasm-IPIs-to-the-same-CPU.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0020-Grow-Wasm-memory-on-demand-in-large-increments.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0021-Add-a-Wasm-memory-balloon.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0022-Share-Wasm-executable-text-between-processes.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0023-Parse-Wasm-binaries-once-per-shared-text.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0024-Report-boot-phases-to-the-host.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0025-Park-pre-spawned-Wasm-secondary-CPUs.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0026-Add-proc-wasmstat.patch"
+        git -C "$LW_SRC/kernel" am < "$LW_ROOT/patches/kernel/0027-Add-HTTP-requests-to-the-Wasm-network-driver.patch"
     handled=1;;&
 
     "fetch-musl"|"all-musl"|"fetch"|"all")
         mkdir -p "$LW_SRC/musl"
         git clone -b v1.2.5 $LW_GITFLAGS https://git.musl-libc.org/git/musl "$LW_SRC/musl"
         git -C "$LW_SRC/musl" am < "$LW_ROOT/patches/musl/0001-NOMERGE-Hacks-to-get-Linux-Wasm-to-compile-minimal-a.patch"
+        git -C "$LW_SRC/musl" am < "$LW_ROOT/patches/musl/0002-Use-the-Wasm-vDSO-data-for-clock_gettime-getpid-and-.patch"
     handled=1;;&
 
     "fetch-busybox-kernel-headers"|"all-busybox-kernel-headers"|"fetch"|"all")
@@ -219,6 +232,11 @@ case "$1" in # note use of ;;& meaning that each case is re-tested (can hit mult
         "$LW_ROOT/tools/build-lwtcp.sh"
     handled=1;;&
 
+    "build-lwhttp"|"all-lwhttp"|"build"|"all"|"build-os")
+        # Build lwhttp, the HTTP client behind httpget and lwpkg
+        "$LW_ROOT/tools/build-lwhttp.sh"
+    handled=1;;&
+
     "build-pkghelper"|"all-pkghelper"|"build"|"all"|"build-os")
         # Build pkghelper for browser-side package downloads
         "$LW_ROOT/tools/build-pkghelper.sh"
@@ -258,30 +276,26 @@ case "$1" in # note use of ;;& meaning that each case is re-tested (can hit mult
         # Copy additional tools to initramfs (lwtcp, sqlite3, jq, etc.)
         mkdir -p "$LW_INSTALL/initramfs-staging/bin"
 
-        # Copy lwtcp if it exists
-        if [ -f "$LW_ROOT/patches/initramfs/lwtcp" ]; then
-            cp "$LW_ROOT/patches/initramfs/lwtcp" "$LW_INSTALL/initramfs-staging/bin/"
-        fi
-
-        # Copy sqlite3 if it exists
-        if [ -f "$LW_ROOT/patches/initramfs/sqlite3" ]; then
-            cp "$LW_ROOT/patches/initramfs/sqlite3" "$LW_INSTALL/initramfs-staging/bin/"
-        fi
-
-        # Copy pkghelper if it exists
+        # pkghelper is part of the core image, it fetches everything else.
         if [ -f "$LW_ROOT/patches/initramfs/pkghelper" ]; then
             cp "$LW_ROOT/patches/initramfs/pkghelper" "$LW_INSTALL/initramfs-staging/bin/"
         fi
 
-        # Copy jq if it exists
-        if [ -f "$LW_ROOT/patches/initramfs/jq" ]; then
-            cp "$LW_ROOT/patches/initramfs/jq" "$LW_INSTALL/initramfs-staging/bin/"
-        fi
-
-        # Copy QuickJS if it exists
-        if [ -f "$LW_ROOT/patches/initramfs/qjs" ]; then
-            cp "$LW_ROOT/patches/initramfs/qjs" "$LW_INSTALL/initramfs-staging/bin/"
-        fi
+        # The bigger tools go into layers instead, which the browser fetches the first time they are run. Each layer
+        # is named by the SHA-256 of its contents (so it can be cached forever and verified), and the core image only
+        # gets a stub that swaps itself for the real binary. Deploy layers/ next to initramfs.cpio.gz.
+        rm -rf "$LW_INSTALL/initramfs/layers"
+        mkdir -p "$LW_INSTALL/initramfs/layers"
+        for LAYER_TOOL in lwtcp lwhttp sqlite3 clockbench lwbench jq qjs
+        do
+            if [ -f "$LW_ROOT/patches/initramfs/$LAYER_TOOL" ]; then
+                LAYER_HASH=$(sha256sum "$LW_ROOT/patches/initramfs/$LAYER_TOOL" | cut -d " " -f 1)
+                cp "$LW_ROOT/patches/initramfs/$LAYER_TOOL" "$LW_INSTALL/initramfs/layers/$LAYER_HASH"
+                sed "s/@LAYER_HASH@/$LAYER_HASH/g" "$LW_ROOT/patches/initramfs/layer-stub" \
+                    > "$LW_INSTALL/initramfs-staging/bin/$LAYER_TOOL"
+                chmod 755 "$LW_INSTALL/initramfs-staging/bin/$LAYER_TOOL"
+            fi
+        done
 
         # Copy any shell scripts from bin directory
         if [ -d "$LW_ROOT/patches/initramfs/bin" ]; then
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * clockbench - Measure the cost of clock_gettime() and getpid() on Linux/Wasm
+ *
+ * Compares the libc fast path (served from the kernel vDSO data) against a
+ * plain syscall, which is what every call used to cost.
+ *
+ * Usage:
+ *   clockbench [iterations]            - Default: 10000000 iterations
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* Linux/Wasm only has the time64 variant, 64-bit hosts only the plain one. */
+#ifndef SYS_clock_gettime64
+#define SYS_clock_gettime64 SYS_clock_gettime
+#endif
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    syscall(SYS_clock_gettime64, CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, long iterations, double seconds)
+{
+    printf("%-32s %10.1f ns/call %12.0f calls/s\n", what,
+           seconds * 1e9 / iterations, iterations / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = 10000000;
+    long i;
+    double start;
+    struct timespec ts, prev = { 0, 0 };
+    volatile long sink = 0;
+
+    if (argc > 1) {
+        iterations = strtol(argv[1], NULL, 10);
+        if (iterations <= 0) {
+            fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("clockbench: %ld iterations\n", iterations);
+
+    /* The fast path must never let time go backwards. */
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (ts.tv_sec < prev.tv_sec ||
+            (ts.tv_sec == prev.tv_sec && ts.tv_nsec < prev.tv_nsec)) {
+            fprintf(stderr, "clockbench: CLOCK_MONOTONIC went backwards: "
+                    "%lld.%09ld -> %lld.%09ld\n",
+                    (long long)prev.tv_sec, prev.tv_nsec,
+                    (long long)ts.tv_sec, ts.tv_nsec);
+            return 1;
+        }
+        prev = ts;
+    }
+    report("clock_gettime(MONOTONIC)", iterations, now_seconds() - start);
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sink += ts.tv_nsec;
+    }
+    report("clock_gettime(REALTIME)", iterations, now_seconds() - start);
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        sink += ts.tv_nsec;
+    }
+    report("clock_gettime(MONOTONIC_COARSE)", iterations, now_seconds() - start);
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++)
+        sink += getpid();
+    report("getpid()", iterations, now_seconds() - start);
+
+    /* Syscalls are much slower, a tenth of the iterations is plenty. */
+    iterations = iterations / 10 ? iterations / 10 : 1;
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        syscall(SYS_clock_gettime64, CLOCK_MONOTONIC, &ts);
+        sink += ts.tv_nsec;
+    }
+    report("syscall(clock_gettime64)", iterations, now_seconds() - start);
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++)
+        sink += syscall(SYS_getpid);
+    report("syscall(getpid)", iterations, now_seconds() - start);
+
+    (void)sink;
+    return 0;
+}
@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * lwbench - Guest side of the Linux/Wasm benchmark suite (see bench/ in the repo)
+ *
+ * Measures what the host-side runner cannot see from the outside: syscall
+ * latency, process spawn rate, pipe and console throughput, and network
+ * throughput through /dev/lwnet against an echo server. Results are printed
+ * for humans, followed by one "LWBENCH {...}" line of JSON for the runner.
+ *
+ * Usage:
+ *   lwbench [scale]                    - All but the network benchmark
+ *   lwbench [scale] net <host> <port>  - All, with an echo server at host:port
+ *
+ * scale multiplies the amount of work (default 1).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* ioctl commands - must match kernel driver (see lwtcp.c) */
+#define LWNET_IOC_MAGIC 'N'
+#define LWNET_OPEN    _IOWR(LWNET_IOC_MAGIC, 1, struct lwnet_open_args)
+#define LWNET_CLOSE   _IOW(LWNET_IOC_MAGIC, 2, int)
+#define LWNET_POLL    _IOR(LWNET_IOC_MAGIC, 4, int)
+
+struct lwnet_open_args {
+    char host[256];
+    int port;
+    int conn_id;
+};
+
+#define POLL_HAS_DATA   1
+#define POLL_CLOSED     2
+#define POLL_ERROR      3
+
+static char buf[65536];
+
+/* The JSON result line, built up as benchmarks finish. */
+static char json[4096] = "{";
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void result(const char *key, double value, const char *unit)
+{
+    size_t len = strlen(json);
+
+    printf("%-24s %14.1f %s\n", key, value, unit);
+    snprintf(json + len, sizeof(json) - len, "%s\"%s\":%.1f",
+             len > 1 ? "," : "", key, value);
+}
+
+static void bench_syscall(long iterations)
+{
+    double start = now_seconds();
+    long i;
+
+    for (i = 0; i < iterations; i++)
+        syscall(SYS_getppid);
+    result("syscall_ns", (now_seconds() - start) * 1e9 / iterations, "ns/call");
+}
+
+static int bench_spawn(long iterations)
+{
+    char *const argv[] = { "true", NULL };
+    double start = now_seconds();
+    long i;
+    int status;
+    pid_t pid;
+
+    /* No MMU means no fork(), vfork() + exec is how everything spawns. */
+    for (i = 0; i < iterations; i++) {
+        pid = vfork();
+        if (pid == 0) {
+            execv("/bin/true", argv);
+            _exit(127);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0) {
+            perror("lwbench: spawn /bin/true");
+            return 1;
+        }
+    }
+    result("spawn_per_s", iterations / (now_seconds() - start), "spawns/s");
+    return 0;
+}
+
+static int bench_pipe(long megabytes)
+{
+    long total = megabytes << 20;
+    long done = 0;
+    double start;
+    int fds[2];
+    ssize_t n;
+
+    if (pipe(fds) < 0) {
+        perror("lwbench: pipe");
+        return 1;
+    }
+
+    /* One process, so it measures the copies and not the scheduler. */
+    start = now_seconds();
+    while (done < total) {
+        n = write(fds[1], buf, 16384);
+        if (n <= 0 || read(fds[0], buf, n) != n) {
+            perror("lwbench: pipe");
+            return 1;
+        }
+        done += n;
+    }
+    result("pipe_mb_per_s", megabytes / (now_seconds() - start), "MB/s");
+
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
+
+static int bench_console(long kilobytes)
+{
+    static const char line[] = "lwbench console throughput 0123456789abcdefghijklmnopqrstuvwxyz\n";
+    long total = kilobytes << 10;
+    long done = 0;
+    double start;
+    int fd = open("/dev/console", O_WRONLY);
+
+    if (fd < 0) {
+        perror("lwbench: open /dev/console");
+        return 1;
+    }
+
+    start = now_seconds();
+    while (done < total) {
+        if (write(fd, line, sizeof(line) - 1) < 0) {
+            perror("lwbench: write /dev/console");
+            return 1;
+        }
+        done += sizeof(line) - 1;
+    }
+    result("console_kb_per_s", kilobytes / (now_seconds() - start), "KB/s");
+
+    close(fd);
+    return 0;
+}
+
+static int bench_net(const char *host, int port, long kilobytes)
+{
+    struct lwnet_open_args args;
+    long total = kilobytes << 10;
+    long sent = 0, received = 0;
+    double start;
+    int poll_status;
+    ssize_t n;
+    int fd;
+
+    fd = open("/dev/lwnet", O_RDWR);
+    if (fd < 0) {
+        perror("lwbench: open /dev/lwnet");
+        return 1;
+    }
+
+    memset(&args, 0, sizeof(args));
+    strncpy(args.host, host, sizeof(args.host) - 1);
+    args.port = port;
+
+    start = now_seconds();
+    if (ioctl(fd, LWNET_OPEN, &args) < 0) {
+        perror("lwbench: ioctl LWNET_OPEN");
+        close(fd);
+        return 1;
+    }
+    result("net_connect_ms", (now_seconds() - start) * 1e3, "ms");
+
+    /* Keep at most 64 KB in flight, the echo comes back through the proxy. */
+    start = now_seconds();
+    while (received < total) {
+        if (sent < total && sent - received < 65536) {
+            n = write(fd, buf, 4096);
+            if (n < 0) {
+                perror("lwbench: write socket");
+                break;
+            }
+            sent += n;
+        }
+
+        if (ioctl(fd, LWNET_POLL, &poll_status) < 0 ||
+            poll_status == POLL_ERROR || poll_status == POLL_CLOSED) {
+            fprintf(stderr, "lwbench: connection lost after %ld bytes\n", received);
+            break;
+        }
+
+        if (poll_status == POLL_HAS_DATA) {
+            n = read(fd, buf, sizeof(buf));
+            if (n < 0 && errno != EAGAIN) {
+                perror("lwbench: read socket");
+                break;
+            }
+            if (n > 0)
+                received += n;
+        } else if (sent >= total || sent - received >= 65536) {
+            usleep(1000);
+        }
+    }
+    if (received >= total)
+        result("net_kb_per_s", kilobytes / (now_seconds() - start), "KB/s");
+
+    ioctl(fd, LWNET_CLOSE, &args.conn_id);
+    close(fd);
+    return received < total;
+}
+
+int main(int argc, char **argv)
+{
+    long scale = 1;
+    int failed = 0;
+    int arg = 1;
+
+    if (argc > arg && strcmp(argv[arg], "net") != 0) {
+        scale = strtol(argv[arg++], NULL, 10);
+        if (scale <= 0) {
+            fprintf(stderr, "Usage: %s [scale] [net <host> <port>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("lwbench: scale %ld\n", scale);
+
+    bench_syscall(100000 * scale);
+    failed |= bench_spawn(50 * scale);
+    failed |= bench_pipe(16 * scale);
+    failed |= bench_console(64 * scale);
+
+    if (argc > arg + 2 && strcmp(argv[arg], "net") == 0)
+        failed |= bench_net(argv[arg + 1], atoi(argv[arg + 2]), 1024 * scale);
+
+    printf("LWBENCH %s}\n", json);
+    return failed;
+}
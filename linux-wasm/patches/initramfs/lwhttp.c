@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * lwhttp - HTTP client for Linux/Wasm
+ *
+ * Usage: lwhttp [-v] [-I] [-o file] [-H 'Name: value']... <url>
+ *
+ * Has the network proxy make the request (ioctl LWNET_HTTP on /dev/lwnet) and
+ * writes the response body to stdout or a file. The proxy follows redirects
+ * and undoes any Content-Encoding, so what arrives is the body as is.
+ *
+ * Exit status: 0 on success, 1 on bad usage or local errors, 2 if the request
+ * could not be made (so scripts can fall back to lwtcp), 3 if the body broke
+ * off, 22 if the server answered with a status of 400 or more.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* ioctl commands - must match kernel driver */
+#define LWNET_IOC_MAGIC 'N'
+#define LWNET_CLOSE   _IOW(LWNET_IOC_MAGIC, 2, int)
+#define LWNET_POLL    _IOR(LWNET_IOC_MAGIC, 4, int)
+#define LWNET_HTTP    _IOWR(LWNET_IOC_MAGIC, 5, struct lwnet_http_args)
+
+struct lwnet_http_args {
+    char method[16];
+    char url[2048];
+    char headers[2048];
+    int status;
+    int conn_id;
+};
+
+/* Poll status values */
+#define POLL_HAS_DATA   1
+#define POLL_CLOSED     2
+#define POLL_ERROR      3
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-v] [-I] [-o file] [-H 'Name: value']... <url>\n", prog);
+    fprintf(stderr, "\n  -v  Print the HTTP status to stderr\n");
+    fprintf(stderr, "  -I  HEAD request (no body)\n");
+    fprintf(stderr, "  -o  Write the body to a file instead of stdout\n");
+    fprintf(stderr, "  -H  Add a request header\n");
+    fprintf(stderr, "\nExample:\n  %s -o index.html https://example.com/\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct lwnet_http_args args;
+    static char buf[65536];
+    const char *out_path = NULL;
+    int verbose = 0;
+    int fd, out, opt, poll_status = -1;
+    size_t headers_len = 0;
+    ssize_t n;
+
+    strcpy(args.method, "GET");
+
+    while ((opt = getopt(argc, argv, "vIo:H:")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'I':
+            strcpy(args.method, "HEAD");
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'H':
+            if (headers_len + strlen(optarg) + 2 > sizeof(args.headers)) {
+                fprintf(stderr, "lwhttp: too many headers\n");
+                return 1;
+            }
+            headers_len += sprintf(args.headers + headers_len, "%s\n", optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    if (strlen(argv[optind]) >= sizeof(args.url)) {
+        fprintf(stderr, "lwhttp: URL too long\n");
+        return 1;
+    }
+    strcpy(args.url, argv[optind]);
+
+    fd = open("/dev/lwnet", O_RDWR);
+    if (fd < 0) {
+        perror("lwhttp: open /dev/lwnet");
+        return 1;
+    }
+
+    if (ioctl(fd, LWNET_HTTP, &args) < 0) {
+        fprintf(stderr, "lwhttp: request to %s failed: %s\n", args.url, strerror(errno));
+        close(fd);
+        return 2;
+    }
+
+    if (verbose)
+        fprintf(stderr, "HTTP %d\n", args.status);
+
+    out = STDOUT_FILENO;
+    if (out_path) {
+        out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            perror("lwhttp: open output");
+            ioctl(fd, LWNET_CLOSE, &args.conn_id);
+            close(fd);
+            return 1;
+        }
+    }
+
+    /* The body, until the proxy closes the connection at its end. */
+    for (;;) {
+        if (ioctl(fd, LWNET_POLL, &poll_status) < 0) {
+            perror("lwhttp: ioctl LWNET_POLL");
+            break;
+        }
+
+        if (poll_status == POLL_HAS_DATA) {
+            n = read(fd, buf, sizeof(buf));
+            if (n > 0 && write(out, buf, n) != n) {
+                perror("lwhttp: write");
+                break;
+            } else if (n < 0 && errno != EAGAIN) {
+                perror("lwhttp: read");
+                break;
+            }
+        } else if (poll_status == POLL_CLOSED) {
+            break;
+        } else if (poll_status == POLL_ERROR) {
+            fprintf(stderr, "lwhttp: connection error\n");
+            poll_status = -1;
+            break;
+        } else {
+            usleep(1000);
+        }
+    }
+
+    ioctl(fd, LWNET_CLOSE, &args.conn_id);
+    close(fd);
+    if (out_path)
+        close(out);
+
+    if (poll_status != POLL_CLOSED)
+        return 3;
+    if (args.status >= 400) {
+        fprintf(stderr, "lwhttp: %s: HTTP %d\n", args.url, args.status);
+        return 22;
+    }
+    return 0;
+}
@@ -10,11 +10,15 @@
  *   pkghelper install <pkg>            - Install package (browser download with progress)
  *   pkghelper restore <pkg> <dest>     - Restore cached package to destination
  *   pkghelper list                     - List cached packages
+ *   pkghelper snapshot                 - Hand the archive on stdin to the browser as boot snapshot
+ *   pkghelper layer <hash> <dest>      - Fetch a lazily loaded initramfs layer to destination
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Import host functions from WASI namespace */
 __attribute__((import_module("wasi_snapshot_preview1"), import_name("wasm_pkg_check")))
@@ -29,6 +33,15 @@ extern int wasm_pkg_restore(const char *pkg_name, const char *dest_path);
 __attribute__((import_module("wasi_snapshot_preview1"), import_name("wasm_pkg_list_cached")))
 extern int wasm_pkg_list_cached(char *buffer, int buffer_size);
 
+__attribute__((import_module("wasi_snapshot_preview1"), import_name("wasm_snapshot_save")))
+extern int wasm_snapshot_save(const char *buffer, int size, int offset);
+
+__attribute__((import_module("wasi_snapshot_preview1"), import_name("wasm_layer_size")))
+extern int wasm_layer_size(const char *hash);
+
+__attribute__((import_module("wasi_snapshot_preview1"), import_name("wasm_layer_read")))
+extern int wasm_layer_read(const char *hash, char *buffer, int size);
+
 static void usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s <command> [args...]\n", prog);
@@ -37,6 +50,8 @@ static void usage(const char *prog)
     fprintf(stderr, "  install <pkg>         Install package (downloads from CDN)\n");
     fprintf(stderr, "  restore <pkg> <dest>  Restore cached package to destination\n");
     fprintf(stderr, "  list                  List cached packages\n");
+    fprintf(stderr, "  snapshot              Save the cpio archive on stdin as boot snapshot\n");
+    fprintf(stderr, "  layer <hash> <dest>   Fetch an initramfs layer to destination\n");
     exit(1);
 }
 
@@ -105,6 +120,85 @@ static int cmd_list(void)
     }
 }
 
+static int cmd_snapshot(void)
+{
+    static char buffer[256 * 1024];
+    size_t size = 0;
+    size_t n;
+
+    /*
+     * Hand the archive over in chunks as it comes, the browser puts them
+     * together. A chunk of 0 bytes at the end says the archive is complete.
+     */
+    while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        int result = wasm_snapshot_save(buffer, (int)n, (int)size);
+        if (result != 0) {
+            fprintf(stderr, "Failed to save boot snapshot (error %d)\n", result);
+            return 1;
+        }
+        size += n;
+    }
+
+    if (ferror(stdin) || size == 0) {
+        fprintf(stderr, "Failed to read snapshot from stdin\n");
+        return 1;
+    }
+
+    int result = wasm_snapshot_save(NULL, 0, (int)size);
+    if (result == 0) {
+        printf("Saved boot snapshot (%zu bytes)\n", size);
+        return 0;
+    } else {
+        fprintf(stderr, "Failed to save boot snapshot (error %d)\n", result);
+        return 1;
+    }
+}
+
+static int cmd_layer(const char *hash, const char *dest)
+{
+    /* Fetches the layer (verified against hash) and tells us how big it is. */
+    int size = wasm_layer_size(hash);
+    if (size < 0) {
+        fprintf(stderr, "Failed to fetch layer %s (error %d)\n", hash, size);
+        return 1;
+    }
+
+    char *buffer = malloc(size ? size : 1);
+    if (!buffer) {
+        fprintf(stderr, "Out of memory fetching layer %s\n", hash);
+        return 1;
+    }
+
+    int result = wasm_layer_read(hash, buffer, size);
+    if (result != size) {
+        fprintf(stderr, "Failed to read layer %s (error %d)\n", hash, result);
+        free(buffer);
+        return 1;
+    }
+
+    /* Write next to dest and rename, so a concurrent first run never sees half a binary. */
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.layer-%d", dest, (int)getpid());
+
+    FILE *out = fopen(tmp, "wb");
+    if (!out) {
+        perror(tmp);
+        free(buffer);
+        return 1;
+    }
+
+    size_t written = fwrite(buffer, 1, size, out);
+    free(buffer);
+    if (fclose(out) != 0 || written != (size_t)size || chmod(tmp, 0755) != 0 || rename(tmp, dest) != 0) {
+        perror(dest);
+        remove(tmp);
+        return 1;
+    }
+
+    printf("Fetched layer %s to %s (%d bytes)\n", hash, dest, size);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -133,6 +227,14 @@ int main(int argc, char *argv[])
         return cmd_restore(argv[2], argv[3]);
     } else if (strcmp(cmd, "list") == 0) {
         return cmd_list();
+    } else if (strcmp(cmd, "snapshot") == 0) {
+        return cmd_snapshot();
+    } else if (strcmp(cmd, "layer") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s layer <hash> <destination>\n", argv[0]);
+            return 1;
+        }
+        return cmd_layer(argv[2], argv[3]);
     } else {
         usage(argv[0]);
     }
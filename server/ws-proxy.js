@@ -7,11 +7,17 @@
 'use strict';
 
 const WebSocket = require('ws');
+const cluster = require('cluster');
 const http = require('http');
+const https = require('https');
 const net = require('net');
 const tls = require('tls');
 const dns = require('dns').promises;
 const crypto = require('crypto');
+const fs = require('fs');
+const os = require('os');
+const { monitorEventLoopDelay } = require('perf_hooks');
+const zlib = require('zlib');
 
 let jwt;
 try {
@@ -20,6 +26,9 @@ try {
   console.warn('jsonwebtoken not installed, JWT auth disabled');
 }
 
+// Optional, for WebTransport. An ES module, so it is imported (see WSProxyServer.startWebTransport()).
+const WEBTRANSPORT_MODULE = '@fails-components/webtransport';
+
 // =============================================================================
 // Configuration
 // =============================================================================
@@ -47,9 +56,19 @@ const CONFIG = {
     '240.0.0.0/4',          // Reserved
     '100.64.0.0/10',        // Carrier-grade NAT
     '169.254.169.254/32',   // Cloud metadata (AWS, GCP, Azure)
+    '::/128',               // Unspecified
+    '::1/128',              // Loopback
+    '::/96',                // IPv4-compatible (deprecated)
+    '100::/64',             // Discard-only
+    '2001::/32',            // Teredo (tunnels to an IPv4 address the blocklist cannot see)
+    '2001:db8::/32',        // Documentation
+    'fc00::/7',             // Unique local (includes AWS metadata, fd00:ec2::254)
+    'fe80::/10',            // Link-local
+    'fec0::/10',            // Site-local (deprecated)
+    'ff00::/8',             // Multicast
   ],
 
-  // Rate limits
+  // Rate limits, as token buckets: a user may burst up to a minute's worth, which refills evenly over the minute
   rateLimits: {
     bytesPerMinute: 10 * 1024 * 1024,  // 10 MB/min
     connectionsPerMinute: 30,
@@ -58,10 +77,67 @@ const CONFIG = {
     idleTimeout: 60000,                 // 1 minute
   },
 
-  // DNS rebinding protection
+  // Requests the proxy makes itself ({t: 'http'}), streaming the body back
+  http: {
+    methods: ['GET', 'HEAD'],
+    maxRedirects: 5,
+  },
+
+  // A guest's connections share its WebSocket by weighted round robin (see StreamScheduler)
+  streams: {
+    chunkSize: 16 * 1024,          // Bytes a connection sends per turn, times its weight
+    highWaterBytes: 64 * 1024,     // Queued on the WebSocket before the scheduler holds frames back
+    maxQueuedBytes: 256 * 1024,    // Queued for one connection before its upstream is paused
+    maxWeight: 16,                 // Guests ask for weights of 1 (default) up to this
+  },
+
+  // WebTransport (HTTP/3) next to the WebSocket: each guest connection gets a QUIC stream of its own, so a lost packet
+  // holds up only the connection it belongs to. Needs the optional WEBTRANSPORT_MODULE and a TLS certificate (for
+  // local testing, a self-signed one: npm run dev-cert). Single process only, UDP cannot be routed like the WebSocket.
+  webTransport: {
+    port: parseInt(process.env.WEBTRANSPORT_PORT || '0', 10),  // UDP port, 0 disables
+    cert: process.env.WEBTRANSPORT_CERT || null,                // PEM files
+    key: process.env.WEBTRANSPORT_KEY || null,
+  },
+
+  // DNS rebinding protection. Answers are cached for their record TTL, kept within these bounds.
   dnsCache: {
     enabled: true,
-    ttl: 300000,  // 5 minutes
+    minTtl: 5000,       // 5 seconds
+    maxTtl: 300000,     // 5 minutes
+    maxEntries: 10000,  // Least recently used hostnames go first
+  },
+
+  // Happy Eyeballs (RFC 8305): a host's addresses are tried in parallel, started this far apart (or as soon as the
+  // attempt before fails), and the first to connect wins.
+  connect: {
+    attemptDelay: 250,
+  },
+
+  // A guest that asks for it (?session=new) gets a session it can resume on a new WebSocket after losing this one:
+  // for this long its connections stay open, and what it has not acknowledged is kept to be sent again.
+  resume: {
+    grace: parseInt(process.env.RESUME_GRACE_MS || '30000', 10),  // 0 disables resumption
+    replayBytes: 1024 * 1024,  // Sent and not yet acknowledged, per guest, before the scheduler holds frames back
+  },
+
+  // Worker processes, each relaying for its own share of users. 0 runs everything in one process, 'auto' uses every
+  // core. Rate limits stay per user across workers: the primary process keeps the counts and hands out byte leases.
+  cluster: {
+    workers: process.env.CLUSTER_WORKERS === 'auto'
+      ? os.cpus().length
+      : parseInt(process.env.CLUSTER_WORKERS || '0', 10),
+    leaseBytes: 256 * 1024,   // Bandwidth a worker may use before asking the primary for more
+  },
+
+  // Bearer token /metrics asks for, none if unset
+  metricsToken: process.env.METRICS_TOKEN || null,
+
+  // Per event log lines, written in batches. INFO lines can be sampled, ERROR lines are always kept; the
+  // lwproxy_events_total metric counts every event either way.
+  logging: {
+    sampleRate: parseFloat(process.env.LOG_SAMPLE_RATE || '1'),  // Fraction of INFO lines kept
+    maxPendingBytes: 1024 * 1024,  // Lines beyond this, while stdout cannot keep up, are dropped and counted
   },
 };
 
@@ -76,45 +152,133 @@ class IPValidator {
 
   parseCIDR(cidr) {
     const [ip, prefixLen] = cidr.split('/');
-    const prefix = parseInt(prefixLen, 10);
-    const parts = ip.split('.').map(n => parseInt(n, 10));
-    return { parts, prefix };
+    const family = net.isIP(ip);
+    const bits = family === 6 ? 128 : 32;
+    const prefix = prefixLen === undefined ? bits : parseInt(prefixLen, 10);
+    return { family, value: this.toBigInt(ip, family), prefix, bits };
+  }
+
+  /**
+   * An address as a number, 32 bits for IPv4 and 128 for IPv6
+   * @param {string} ip - Valid address (net.isIP() said so)
+   */
+  toBigInt(ip, family) {
+    if (family === 4) {
+      return ip.split('.').reduce((value, part) => (value << 8n) | BigInt(parseInt(part, 10)), 0n);
+    }
+
+    // Groups on either side of '::', which stands for as many zero groups as are missing. The last group may be a
+    // dotted IPv4 address (::ffff:192.0.2.1), which counts for two.
+    const groups = (part) => part === '' ? [] : part.split(':').flatMap((group) => {
+      if (group.includes('.')) {
+        const v4 = this.toBigInt(group, 4);
+        return [v4 >> 16n, v4 & 0xffffn];
+      }
+      return [BigInt(parseInt(group, 16))];
+    });
+
+    const halves = ip.split('%')[0].split('::');
+    const head = groups(halves[0]);
+    const tail = halves.length > 1 ? groups(halves[1]) : [];
+    const zeros = new Array(8 - head.length - tail.length).fill(0n);
+    return [...head, ...zeros, ...tail].reduce((value, group) => (value << 16n) | group, 0n);
   }
 
   isBlocked(ip) {
-    // Handle IPv4-mapped IPv6 addresses
-    if (ip.startsWith('::ffff:')) {
-      ip = ip.substring(7);
+    const family = net.isIP(ip);
+    if (family === 0) {
+      return true; // Invalid IP, block it
     }
 
-    // Only handle IPv4 for now
-    if (ip.includes(':')) {
-      // Block all IPv6 private ranges
-      if (ip === '::1' || ip.startsWith('fc') || ip.startsWith('fd') || ip.startsWith('fe80')) {
-        return true;
+    // IPv6 addresses that lead to an IPv4 address get checked as that address too
+    const value = this.toBigInt(ip, family);
+    const candidates = [{ family, value }];
+    if (family === 6) {
+      const prefix96 = value >> 32n;
+      if (prefix96 === 0xffffn || prefix96 === 0x64ff9b0000000000000000n) {
+        // IPv4-mapped (::ffff:0:0/96) and NAT64 (64:ff9b::/96)
+        candidates.push({ family: 4, value: value & 0xffffffffn });
+      } else if (value >> 112n === 0x2002n) {
+        // 6to4 (2002::/16)
+        candidates.push({ family: 4, value: (value >> 80n) & 0xffffffffn });
       }
+    }
+
+    return candidates.some((address) => this.blockedRanges.some((range) => this.matchesCIDR(address, range)));
+  }
+
+  matchesCIDR(address, range) {
+    if (address.family !== range.family) {
       return false;
     }
+    const shift = BigInt(range.bits - range.prefix);
+    return (address.value >> shift) === (range.value >> shift);
+  }
+}
 
-    const parts = ip.split('.').map(n => parseInt(n, 10));
-    if (parts.length !== 4 || parts.some(n => isNaN(n) || n < 0 || n > 255)) {
-      return true; // Invalid IP, block it
+// =============================================================================
+// Time Wheel - Expiry for many entries at once
+// =============================================================================
+
+/**
+ * Calls onExpire(item) once an item's time has come, to within a tick.
+ *
+ * Items sit in a ring of slots a tick apart, so scheduling and cancelling cost the same however many items there are,
+ * and a tick only looks at the items due then. Items are objects, the wheel keeps its bookkeeping in item.wheelSlot.
+ * Times further out than span are brought in to span, onExpire checks whether the item is really due.
+ */
+class TimeWheel {
+  constructor(tick, span, onExpire) {
+    this.tick = tick;
+    this.slots = Array.from({ length: Math.ceil(span / tick) + 1 }, () => new Set());
+    this.onExpire = onExpire;
+    this.size = 0;
+    this.current = Math.floor(Date.now() / tick);
+
+    this.timer = setInterval(() => this.advance(), tick);
+    this.timer.unref();
+  }
+
+  schedule(item, at) {
+    const due = Math.min(Math.max(Math.ceil(at / this.tick), this.current + 1), this.current + this.slots.length - 1);
+    const slot = due % this.slots.length;
+    if (item.wheelSlot === slot) {
+      return;
     }
+    this.cancel(item);
+    this.slots[slot].add(item);
+    item.wheelSlot = slot;
+    this.size++;
+  }
 
-    for (const range of this.blockedRanges) {
-      if (this.matchesCIDR(parts, range.parts, range.prefix)) {
-        return true;
-      }
+  cancel(item) {
+    if (item.wheelSlot != null) {
+      this.slots[item.wheelSlot].delete(item);
+      item.wheelSlot = null;
+      this.size--;
     }
+  }
 
-    return false;
+  advance() {
+    const now = Math.floor(Date.now() / this.tick);
+
+    // After a stall longer than the ring, every slot is due once.
+    this.current = Math.max(this.current, now - this.slots.length);
+    while (this.current < now) {
+      this.current++;
+      const index = this.current % this.slots.length;
+      const due = this.slots[index];
+      this.slots[index] = new Set();
+      this.size -= due.size;
+      for (const item of due) {
+        item.wheelSlot = null;
+        this.onExpire(item);
+      }
+    }
   }
 
-  matchesCIDR(ip, rangeIp, prefix) {
-    const ipNum = (ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | ip[3];
-    const rangeNum = (rangeIp[0] << 24) | (rangeIp[1] << 16) | (rangeIp[2] << 8) | rangeIp[3];
-    const mask = prefix === 0 ? 0 : (~0 << (32 - prefix)) >>> 0;
-    return (ipNum & mask) === (rangeNum & mask);
+  stop() {
+    clearInterval(this.timer);
   }
 }
 
@@ -122,73 +286,302 @@ class IPValidator {
 // Rate Limiter
 // =============================================================================
 
+/**
+ * Per user token buckets: one of connections, one of bytes, each refilling at its per minute limit.
+ *
+ * A user with nothing open is forgotten once both buckets are full again, since a new entry starts out full and
+ * forgetting then changes nothing. Memory is bounded by the users active within the last minute.
+ */
 class RateLimiter {
   constructor(config) {
     this.config = config;
     this.userStats = new Map();
+    this.expiry = new TimeWheel(1000, 60000, (stats) => this.expire(stats));
   }
 
   getStats(userId) {
-    if (!this.userStats.has(userId)) {
-      this.userStats.set(userId, {
-        bytesThisMinute: 0,
-        connectionsThisMinute: 0,
+    let stats = this.userStats.get(userId);
+    if (!stats) {
+      stats = {
+        userId,
+        connections: this.config.connectionsPerMinute,
+        bytes: this.config.bytesPerMinute,
         activeConnections: 0,
-        lastReset: Date.now(),
-      });
+        updated: Date.now(),
+      };
+      this.userStats.set(userId, stats);
+      this.touch(stats);
     }
 
-    const stats = this.userStats.get(userId);
+    this.refill(stats);
+    return stats;
+  }
+
+  refill(stats) {
+    const now = Date.now();
+    const minutes = (now - stats.updated) / 60000;
+    stats.connections = Math.min(this.config.connectionsPerMinute,
+      stats.connections + minutes * this.config.connectionsPerMinute);
+    stats.bytes = Math.min(this.config.bytesPerMinute, stats.bytes + minutes * this.config.bytesPerMinute);
+    stats.updated = now;
+  }
 
-    // Reset counters every minute
-    if (Date.now() - stats.lastReset > 60000) {
-      stats.bytesThisMinute = 0;
-      stats.connectionsThisMinute = 0;
-      stats.lastReset = Date.now();
+  // (Re)schedule expiry after a change: when both buckets will be full, or never while connections are open
+  touch(stats) {
+    if (stats.activeConnections > 0) {
+      this.expiry.cancel(stats);
+      return;
     }
+    const minutes = Math.max(
+      1 - stats.connections / this.config.connectionsPerMinute,
+      1 - stats.bytes / this.config.bytesPerMinute);
+    this.expiry.schedule(stats, stats.updated + minutes * 60000);
+  }
 
-    return stats;
+  expire(stats) {
+    this.refill(stats);
+    if (stats.activeConnections === 0 &&
+        stats.connections >= this.config.connectionsPerMinute && stats.bytes >= this.config.bytesPerMinute) {
+      this.userStats.delete(stats.userId);
+    } else {
+      this.touch(stats);
+    }
   }
 
-  canConnect(userId) {
+  /**
+   * Check the limits and, if they allow it, count a connection for the user right away, so that concurrent opens
+   * cannot all pass the check. Every allowed reservation must be given back with recordDisconnection(), also when
+   * the connection then fails.
+   */
+  reserveConnection(userId) {
     const stats = this.getStats(userId);
 
-    if (stats.connectionsThisMinute >= this.config.connectionsPerMinute) {
-      return { allowed: false, reason: 'Connection rate limit exceeded' };
+    if (stats.connections < 1) {
+      return { allowed: false, limit: 'connections', reason: 'Connection rate limit exceeded' };
     }
 
     if (stats.activeConnections >= this.config.maxConcurrentConnections) {
-      return { allowed: false, reason: 'Max concurrent connections exceeded' };
+      return { allowed: false, limit: 'concurrent', reason: 'Max concurrent connections exceeded' };
     }
 
+    stats.connections--;
+    stats.activeConnections++;
+    this.touch(stats);
     return { allowed: true };
   }
 
   canTransfer(userId, bytes) {
     const stats = this.getStats(userId);
 
-    if (stats.bytesThisMinute + bytes > this.config.bytesPerMinute) {
-      return { allowed: false, reason: 'Bandwidth limit exceeded' };
+    if (stats.bytes < bytes) {
+      return { allowed: false, limit: 'bandwidth', reason: 'Bandwidth limit exceeded' };
     }
 
     return { allowed: true };
   }
 
-  recordConnection(userId) {
-    const stats = this.getStats(userId);
-    stats.connectionsThisMinute++;
-    stats.activeConnections++;
-  }
-
   recordDisconnection(userId) {
     const stats = this.getStats(userId);
     stats.activeConnections = Math.max(0, stats.activeConnections - 1);
+    this.touch(stats);
   }
 
   recordBytes(userId, bytes) {
     const stats = this.getStats(userId);
-    stats.bytesThisMinute += bytes;
+    stats.bytes -= bytes;
+    this.touch(stats);
+  }
+
+  /**
+   * Take up to max bytes out of the user's bucket at once (ClusterRateLimiter leases)
+   * @returns {{bytes: number, retryIn: number}} retryIn is how long until max bytes are there again, in ms
+   */
+  grantBytes(userId, max) {
+    const stats = this.getStats(userId);
+    const bytes = Math.max(0, Math.min(max, Math.floor(stats.bytes)));
+    stats.bytes -= bytes;
+    this.touch(stats);
+    return { bytes, retryIn: Math.max(0, Math.ceil((max - stats.bytes) / this.config.bytesPerMinute * 60000)) };
+  }
+
+  // Give back bytes that were granted but not used
+  refundBytes(userId, bytes) {
+    const stats = this.getStats(userId);
+    stats.bytes = Math.min(this.config.bytesPerMinute, stats.bytes + bytes);
+    this.touch(stats);
+  }
+
+  metrics() {
+    return { users: this.userStats.size, expiring: this.expiry.size };
+  }
+
+  registerMetrics(metrics) {
+    metrics.gauge('lwproxy_rate_limiter_users', 'Users the rate limiter keeps state for', {
+      collect: (gauge) => gauge.set(this.userStats.size),
+    });
+  }
+}
+
+// =============================================================================
+// Cluster Rate Limiter - RateLimiter for a worker process
+// =============================================================================
+
+/**
+ * Same interface as RateLimiter, but the counts live in the primary process (a RateLimiter there), so that limits hold
+ * for a user whose WebSockets ended up on different workers.
+ *
+ * Connection reservations ask the primary. Bandwidth cannot wait for it on every chunk, so the worker draws on a lease
+ * of bytes that the primary has already taken out of the user's bucket, and asks for the next one when it runs low.
+ * While that is on its way, transfers overdraw the lease. Once the primary has nothing left to grant, transfers are
+ * refused until the bucket has refilled by a lease. A user can exceed bytesPerMinute by at most a lease and a chunk
+ * per worker. Leases of users with nothing open are handed back.
+ */
+class ClusterRateLimiter {
+  constructor(config, leaseBytes) {
+    this.config = config;
+    this.leaseBytes = leaseBytes;
+    this.leases = new Map();
+    this.requests = new Map();
+    this.nextRequestId = 1;
+
+    process.on('message', (msg) => {
+      if (msg && msg.t === 'rl' && this.requests.has(msg.id)) {
+        this.requests.get(msg.id)(msg);
+        this.requests.delete(msg.id);
+      }
+    });
+  }
+
+  request(op, userId) {
+    return new Promise((resolve) => {
+      const id = this.nextRequestId++;
+      this.requests.set(id, resolve);
+      process.send({ t: 'rl', id, op, userId });
+    });
+  }
+
+  getLease(userId) {
+    if (!this.leases.has(userId)) {
+      this.leases.set(userId, { bytes: 0, pending: false, exhaustedUntil: 0, activeConnections: 0 });
+    }
+    return this.leases.get(userId);
+  }
+
+  // What is left of a lease goes back to the primary with it
+  release(userId, lease) {
+    this.leases.delete(userId);
+    if (lease.bytes >= 1) {
+      process.send({ t: 'rl', op: 'refund', userId, bytes: Math.floor(lease.bytes) });
+    }
+  }
+
+  async reserveConnection(userId) {
+    const reply = await this.request('reserveConnection', userId);
+    if (reply.allowed) {
+      this.getLease(userId).activeConnections++;
+    }
+    return { allowed: reply.allowed, limit: reply.limit, reason: reply.reason };
+  }
+
+  canTransfer(userId, bytes) {
+    const lease = this.getLease(userId);
+
+    if (lease.bytes < bytes && Date.now() < lease.exhaustedUntil) {
+      return { allowed: false, limit: 'bandwidth', reason: 'Bandwidth limit exceeded' };
+    }
+
+    return { allowed: true };
   }
+
+  recordDisconnection(userId) {
+    const lease = this.getLease(userId);
+    lease.activeConnections = Math.max(0, lease.activeConnections - 1);
+    process.send({ t: 'rl', op: 'recordDisconnection', userId });
+
+    if (lease.activeConnections === 0 && !lease.pending) {
+      this.release(userId, lease);
+    }
+  }
+
+  recordBytes(userId, bytes) {
+    const lease = this.getLease(userId);
+    lease.bytes -= bytes;
+
+    if (lease.bytes < this.leaseBytes / 2 && !lease.pending && Date.now() >= lease.exhaustedUntil) {
+      lease.pending = true;
+      this.request('grant', userId).then((reply) => {
+        lease.pending = false;
+        lease.bytes += reply.bytes;
+        if (reply.bytes === 0) {
+          lease.exhaustedUntil = Date.now() + reply.retryIn;
+        }
+        if (lease.activeConnections === 0 && this.leases.get(userId) === lease) {
+          this.release(userId, lease);
+        }
+      });
+    }
+  }
+
+  metrics() {
+    return { users: this.leases.size };
+  }
+}
+
+/**
+ * Answer the requests of ClusterRateLimiter, in the primary process
+ */
+function serveClusterRateLimits(rateLimiter, leaseBytes) {
+  // Connections each worker holds per user, given back if the worker dies
+  const held = new Map();
+
+  const hold = (worker, userId, delta) => {
+    if (!held.has(worker.id)) {
+      held.set(worker.id, new Map());
+    }
+    const users = held.get(worker.id);
+    const count = (users.get(userId) || 0) + delta;
+    if (count > 0) {
+      users.set(userId, count);
+    } else {
+      users.delete(userId);
+    }
+  };
+
+  cluster.on('message', (worker, msg) => {
+    if (!msg || msg.t !== 'rl') {
+      return;
+    }
+
+    switch (msg.op) {
+      case 'reserveConnection': {
+        const reply = rateLimiter.reserveConnection(msg.userId);
+        if (reply.allowed) {
+          hold(worker, msg.userId, 1);
+        }
+        worker.send({ t: 'rl', id: msg.id, ...reply });
+        break;
+      }
+      case 'recordDisconnection':
+        hold(worker, msg.userId, -1);
+        rateLimiter.recordDisconnection(msg.userId);
+        break;
+      case 'grant':
+        worker.send({ t: 'rl', id: msg.id, ...rateLimiter.grantBytes(msg.userId, leaseBytes) });
+        break;
+      case 'refund':
+        rateLimiter.refundBytes(msg.userId, msg.bytes);
+        break;
+    }
+  });
+
+  cluster.on('exit', (worker) => {
+    for (const [userId, count] of held.get(worker.id) || []) {
+      for (let i = 0; i < count; i++) {
+        rateLimiter.recordDisconnection(userId);
+      }
+    }
+    held.delete(worker.id);
+  });
 }
 
 // =============================================================================
@@ -196,44 +589,128 @@ class RateLimiter {
 // =============================================================================
 
 class DNSResolver {
-  constructor(config, ipValidator) {
+  constructor(config, ipValidator, metrics = new Metrics()) {
     this.config = config;
     this.ipValidator = ipValidator;
-    this.cache = new Map();
+
+    this.lookupSeconds = metrics.histogram('lwproxy_dns_lookup_seconds', 'DNS lookups on cache misses, AAAA and A');
+    const resolutions = metrics.counter('lwproxy_dns_resolutions_total', 'Hostnames resolved, by cache result');
+    this.cacheHits = resolutions.labels({ result: 'hit' });
+    this.cacheMisses = resolutions.labels({ result: 'miss' });
+    metrics.gauge('lwproxy_dns_cache_entries', 'Hostnames in the DNS cache', {
+      collect: (gauge) => gauge.set(this.cache.size),
+    });
+
+    this.cache = new Map();  // hostname -> { hostname, result, expires }, least recently used first
+    if (config.enabled) {
+      this.expiry = new TimeWheel(1000, config.maxTtl, (entry) => this.expire(entry));
+    }
+  }
+
+  expire(entry) {
+    if (this.cache.get(entry.hostname) !== entry) {
+      return;
+    }
+    if (Date.now() < entry.expires) {
+      this.expiry.schedule(entry, entry.expires);
+    } else {
+      this.cache.delete(entry.hostname);
+    }
   }
 
+  metrics() {
+    return { entries: this.cache.size };
+  }
+
+  /**
+   * Resolve a hostname to addresses that are all safe to connect to
+   * @returns {Promise<{ip: string, addresses: string[], hostname: string}>} addresses in the order to try them,
+   *   ip is the first
+   */
   async resolveAndValidate(hostname) {
+    // URL hostnames keep the brackets around IPv6 literals
+    if (hostname.startsWith('[') && hostname.endsWith(']')) {
+      hostname = hostname.slice(1, -1);
+    }
+
+    // An address literal needs no lookup (nor caching), but still gets validated
+    if (net.isIP(hostname)) {
+      if (this.ipValidator.isBlocked(hostname)) {
+        throw new Error(`Blocked IP address: ${hostname}`);
+      }
+      return { ip: hostname, addresses: [hostname], hostname };
+    }
+
     // Check cache
     if (this.config.enabled) {
       const cached = this.cache.get(hostname);
-      if (cached && Date.now() - cached.timestamp < this.config.ttl) {
+      if (cached && Date.now() < cached.expires) {
+        this.cache.delete(hostname);
+        this.cache.set(hostname, cached);
+        this.cacheHits.inc();
         return cached.result;
       }
     }
-
-    // Resolve DNS
-    let addresses;
-    try {
-      addresses = await dns.resolve4(hostname);
-    } catch (err) {
-      throw new Error(`DNS resolution failed for ${hostname}: ${err.message}`);
+    this.cacheMisses.inc();
+
+    // Resolve DNS, both families at once
+    const started = performance.now();
+    const [aaaa, a] = await Promise.allSettled([
+      dns.resolve6(hostname, { ttl: true }),
+      dns.resolve4(hostname, { ttl: true }),
+    ]);
+    this.lookupSeconds.observe((performance.now() - started) / 1000);
+    if (aaaa.status === 'rejected' && a.status === 'rejected') {
+      throw new Error(`DNS resolution failed for ${hostname}: ${a.reason.message}`);
     }
+    const v6 = aaaa.status === 'fulfilled' ? aaaa.value : [];
+    const v4 = a.status === 'fulfilled' ? a.value : [];
 
-    if (!addresses || addresses.length === 0) {
+    if (v6.length === 0 && v4.length === 0) {
       throw new Error(`No addresses found for ${hostname}`);
     }
 
-    const ip = addresses[0];
+    // CRITICAL: Validate every address, not only the first. One blocked address blocks the hostname: which
+    // address a connection ends up on is up to the race, and a name mixing public and internal addresses is
+    // a rebinding attempt anyway.
+    for (const { address } of [...v6, ...v4]) {
+      if (this.ipValidator.isBlocked(address)) {
+        throw new Error(`Blocked IP address: ${address} (resolved from ${hostname})`);
+      }
+    }
 
-    // CRITICAL: Validate IP is not in blocked ranges
-    if (this.ipValidator.isBlocked(ip)) {
-      throw new Error(`Blocked IP address: ${ip} (resolved from ${hostname})`);
+    // Alternate the families, IPv6 first (RFC 8305), so a family that does not work costs one attempt delay
+    const addresses = [];
+    for (let i = 0; i < Math.max(v6.length, v4.length); i++) {
+      if (i < v6.length) {
+        addresses.push(v6[i].address);
+      }
+      if (i < v4.length) {
+        addresses.push(v4[i].address);
+      }
     }
 
-    const result = { ip, hostname };
+    const result = { ip: addresses[0], addresses, hostname };
 
     if (this.config.enabled) {
-      this.cache.set(hostname, { result, timestamp: Date.now() });
+      const ttl = Math.min(...v6.map(r => r.ttl), ...v4.map(r => r.ttl)) * 1000;
+      const entry = {
+        hostname,
+        result,
+        expires: Date.now() + Math.min(Math.max(ttl, this.config.minTtl), this.config.maxTtl),
+      };
+
+      const previous = this.cache.get(hostname);
+      if (previous) {
+        this.expiry.cancel(previous);
+        this.cache.delete(hostname);
+      } else if (this.cache.size >= this.config.maxEntries) {
+        const oldest = this.cache.values().next().value;
+        this.expiry.cancel(oldest);
+        this.cache.delete(oldest.hostname);
+      }
+      this.cache.set(hostname, entry);
+      this.expiry.schedule(entry, entry.expires);
     }
 
     return result;
@@ -241,115 +718,1068 @@ class DNSResolver {
 }
 
 // =============================================================================
-// Authenticator
+// Connector - Happy Eyeballs connection racing
 // =============================================================================
 
-class Authenticator {
-  constructor(config) {
+class Connector {
+  constructor(config, connectionTimeout) {
     this.config = config;
+    this.connectionTimeout = connectionTimeout;
   }
 
-  authenticate(request) {
-    if (!this.config.enabled) {
-      return { authenticated: true, userId: 'anonymous' };
-    }
+  /**
+   * Connect to whichever of the addresses answers first
+   *
+   * Attempts start attemptDelay apart, or as soon as the attempt before fails, and run in parallel. The first to
+   * connect wins and the others are dropped, so a dead address costs one attempt delay instead of the whole
+   * connection timeout. With a servername, the winner is then upgraded to TLS.
+   * @param {string[]} addresses - Validated addresses, in the order to try them
+   * @param {number} port
+   * @param {string|null} servername - Host to verify the certificate for, null for plain TCP
+   * @returns {Promise<net.Socket|tls.TLSSocket>}
+   */
+  async connect(addresses, port, servername) {
+    const socket = await this.race(addresses, port);
+    return servername ? this.upgrade(socket, servername) : socket;
+  }
 
-    // Try JWT from query parameter (WebSocket can't set headers easily)
-    const url = new URL(request.url, `http://${request.headers.host}`);
-    const token = url.searchParams.get('token');
+  race(addresses, port) {
+    return new Promise((resolve, reject) => {
+      const attempts = [];
+      let next = 0;
+      let failed = 0;
+      let done = false;
+      let delay = null;
+
+      const finish = (err, winner) => {
+        if (done) {
+          return;
+        }
+        done = true;
+        clearTimeout(delay);
+        clearTimeout(deadline);
+        for (const attempt of attempts) {
+          if (attempt !== winner) {
+            attempt.destroy();
+          }
+        }
+        if (err) {
+          reject(err);
+        } else {
+          resolve(winner);
+        }
+      };
 
-    if (token && jwt) {
-      try {
-        const decoded = jwt.verify(token, this.config.jwtSecret);
-        return { authenticated: true, userId: decoded.sub || decoded.userId || 'jwt-user' };
-      } catch (err) {
-        return { authenticated: false, error: 'Invalid JWT token' };
-      }
-    }
+      const start = () => {
+        clearTimeout(delay);
+        if (done || next >= addresses.length) {
+          return;
+        }
 
-    // Try Authorization header
-    const authHeader = request.headers['authorization'];
-    if (authHeader && authHeader.startsWith('Bearer ') && jwt) {
-      const headerToken = authHeader.substring(7);
-      try {
-        const decoded = jwt.verify(headerToken, this.config.jwtSecret);
-        return { authenticated: true, userId: decoded.sub || decoded.userId || 'jwt-user' };
-      } catch (err) {
-        return { authenticated: false, error: 'Invalid JWT token' };
-      }
-    }
+        const socket = net.connect({ host: addresses[next++], port });
+        attempts.push(socket);
+
+        const onError = (err) => {
+          if (++failed === addresses.length) {
+            finish(err);
+          } else {
+            start();
+          }
+        };
+        socket.on('error', onError);
+        socket.once('connect', () => {
+          socket.removeListener('error', onError);
+          finish(null, socket);
+        });
 
-    return { authenticated: false, error: 'No valid authentication provided' };
+        delay = setTimeout(start, this.config.attemptDelay);
+      };
+
+      const deadline = setTimeout(() => finish(new Error('Connection timeout')), this.connectionTimeout);
+      start();
+    });
+  }
+
+  upgrade(socket, servername) {
+    return new Promise((resolve, reject) => {
+      const secure = tls.connect({
+        socket,
+        host: servername,  // Name the certificate is checked against
+        servername: net.isIP(servername) ? undefined : servername,  // SNI, which takes no addresses
+        rejectUnauthorized: true,
+      });
+
+      secure.setTimeout(this.connectionTimeout, () => secure.destroy(new Error('Connection timeout')));
+      secure.once('error', reject);
+      secure.once('secureConnect', () => {
+        secure.setTimeout(0);
+        secure.removeListener('error', reject);
+        resolve(secure);
+      });
+    });
   }
 }
 
 // =============================================================================
-// Logger
+// Stream Scheduler - Sharing a WebSocket between connections
 // =============================================================================
 
-class Logger {
-  log(level, userId, action, details = {}) {
-    const entry = {
-      timestamp: new Date().toISOString(),
-      level,
-      userId,
-      action,
-      ...details,
-    };
-    console.log(JSON.stringify(entry));
+/**
+ * Weighted round robin over per-connection send queues: deficit round robin, with a list for new streams as in
+ * FQ-CoDel.
+ *
+ * Frames go to the WebSocket only while it has less than highWater bytes queued. The rest wait in their connection's
+ * queue. Each turn, a connection may send chunkSize * weight bytes. A connection that had nothing queued goes ahead
+ * of the busy ones for its first turn, so an interactive session's keystrokes do not wait behind a download's backlog.
+ * Frames that cost 0 bytes (control messages) take no share, but keep their place in the order.
+ *
+ * site/net-proxy.js has the same scheduler for the other direction.
+ */
+class StreamScheduler {
+  constructor(options) {
+    this.chunkSize = options.chunkSize;
+    this.highWater = options.highWater;
+    this.send = options.send;                      // (frame) => void
+    this.bufferedAmount = options.bufferedAmount;  // () => bytes queued on the WebSocket
+    this.streams = new Map();
+    this.newStreams = [];
+    this.oldStreams = [];
+    this.stopped = false;
   }
 
-  info(userId, action, details) {
-    this.log('INFO', userId, action, details);
+  stream(id) {
+    let stream = this.streams.get(id);
+    if (!stream) {
+      stream = { id, weight: 1, frames: [], bytes: 0, deficit: 0, list: null, waiter: null };
+      this.streams.set(id, stream);
+    }
+    return stream;
   }
 
-  error(userId, action, error) {
-    this.log('ERROR', userId, action, { error: error.message || error });
+  setWeight(id, weight) {
+    this.stream(id).weight = weight;
   }
-}
 
-// =============================================================================
-// WebSocket Proxy Server
-// =============================================================================
+  /**
+   * Queue a frame for a stream
+   * @param {number} bytes - What the frame counts for against the stream's share
+   * @param {boolean} last - Forget the stream once this frame has been sent
+   */
+  push(id, frame, bytes, last = false) {
+    if (this.stopped) {
+      return;
+    }
+    const stream = this.stream(id);
+    stream.frames.push({ frame, bytes, last });
+    stream.bytes += bytes;
+    if (stream.list === null) {
+      stream.deficit = this.chunkSize * stream.weight;
+      stream.list = this.newStreams;
+      this.newStreams.push(stream);
+    }
+    this.pump();
+  }
 
-class WSProxyServer {
-  constructor(config) {
-    this.config = config;
-    this.ipValidator = new IPValidator(config.blockedCIDRs);
-    this.rateLimiter = new RateLimiter(config.rateLimits);
-    this.dnsResolver = new DNSResolver(config.dnsCache, this.ipValidator);
-    this.authenticator = new Authenticator(config.auth);
-    this.logger = new Logger();
+  // Bytes queued for a stream
+  queued(id) {
+    const stream = this.streams.get(id);
+    return stream ? stream.bytes : 0;
   }
 
-  start() {
-    const server = http.createServer((req, res) => {
-      // Health check endpoint
-      if (req.url === '/health') {
-        res.writeHead(200, { 'Content-Type': 'text/plain' });
-        res.end('OK');
-        return;
-      }
+  // Call fn once no more than bytes are queued for a stream
+  whenBelow(id, bytes, fn) {
+    this.stream(id).waiter = { bytes, fn };
+  }
 
-      // CORS preflight
-      if (req.method === 'OPTIONS') {
-        res.writeHead(204, {
-          'Access-Control-Allow-Origin': '*',
-          'Access-Control-Allow-Methods': 'GET, OPTIONS',
-          'Access-Control-Allow-Headers': 'Authorization',
-        });
-        res.end();
+  // Forget a stream, and what it has queued
+  drop(id) {
+    const stream = this.streams.get(id);
+    if (stream) {
+      this.unlist(stream);
+      this.streams.delete(id);
+    }
+  }
+
+  unlist(stream) {
+    if (stream.list) {
+      stream.list.splice(stream.list.indexOf(stream), 1);
+      stream.list = null;
+    }
+  }
+
+  pump() {
+    while (this.bufferedAmount() < this.highWater) {
+      const list = this.newStreams.length ? this.newStreams : this.oldStreams;
+      const stream = list[0];
+      if (!stream) {
         return;
       }
 
-      res.writeHead(404);
-      res.end('Not found');
-    });
+      if (stream.frames.length === 0) {
+        // A new stream that ran dry goes to the end of the old ones first, so it cannot jump the queue again
+        // right away by sending a little at a time.
+        list.shift();
+        if (list === this.newStreams) {
+          stream.list = this.oldStreams;
+          this.oldStreams.push(stream);
+        } else {
+          stream.list = null;
+        }
+        continue;
+      }
 
-    const wss = new WebSocket.Server({ server });
+      if (stream.deficit <= 0) {
+        list.shift();
+        stream.deficit += this.chunkSize * stream.weight;
+        stream.list = this.oldStreams;
+        this.oldStreams.push(stream);
+        continue;
+      }
+
+      const { frame, bytes, last } = stream.frames.shift();
+      stream.bytes -= bytes;
+      stream.deficit -= bytes;
+      this.send(frame);
+
+      if (last) {
+        this.drop(stream.id);
+      } else if (stream.waiter && stream.bytes <= stream.waiter.bytes) {
+        const { fn } = stream.waiter;
+        stream.waiter = null;
+        fn();
+      }
+    }
+
+    // Held back: the owner pumps again once the WebSocket drains, or the guest acknowledges or comes back
+  }
+
+  stop() {
+    this.stopped = true;
+    this.streams.clear();
+    this.newStreams = [];
+    this.oldStreams = [];
+  }
+}
+
+// =============================================================================
+// WebTransport Session - A QUIC stream per connection
+// =============================================================================
+
+// Longest control message line a WebTransport guest may send
+const MAX_LINE = 1024 * 1024;
+
+// Lines of text from a stream of bytes
+async function* readLines(readable) {
+  const decoder = new TextDecoder();
+  let text = '';
+  for await (const chunk of readable) {
+    text += decoder.decode(chunk, { stream: true });
+    let newline;
+    while ((newline = text.indexOf('\n')) >= 0) {
+      yield text.slice(0, newline);
+      text = text.slice(newline + 1);
+    }
+    if (text.length > MAX_LINE) {
+      throw new Error('Line too long');
+    }
+  }
+}
+
+/**
+ * A guest on WebTransport, standing in for both its WebSocket and that WebSocket's StreamScheduler, so the handlers
+ * serve either transport.
+ *
+ * Control messages (the same JSON as on the WebSocket, one per line) go both ways on the first bidirectional stream
+ * the guest opens. For every connection it opens another, starting with the 4-byte big-endian connection ID, and the
+ * connection's data goes both ways on that, raw. The end of a stream is the end of the connection in that direction,
+ * which the guest treats as {t: 'closed'}: on separate streams, a message could overtake the last of the data.
+ *
+ * QUIC's per-stream flow control does what the scheduler's queues do on the WebSocket, so data for a connection
+ * goes straight to its stream. Weights are not applied.
+ */
+class WebTransportSession {
+  constructor(session, control) {
+    this.session = session;
+    this.control = control.writable.getWriter();
+    this.streams = new Map();  // id -> { writer, pending, bytes, waiter, finished }
+    this.readyState = WebSocket.OPEN;
+    this.encoder = new TextEncoder();
+  }
+
+  // Bytes handed to streams and not yet taken by QUIC, as bufferedAmount is for the WebSocket
+  get bufferedAmount() {
+    let bytes = 0;
+    for (const stream of this.streams.values()) {
+      bytes += stream.bytes;
+    }
+    return bytes;
+  }
+
+  send(text) {
+    if (this.readyState === WebSocket.OPEN) {
+      this.control.write(this.encoder.encode(text + '\n')).catch(() => {});
+    }
+  }
+
+  stream(id) {
+    let stream = this.streams.get(id);
+    if (!stream) {
+      stream = { writer: null, pending: [], bytes: 0, waiter: null, finished: false };
+      this.streams.set(id, stream);
+    }
+    return stream;
+  }
+
+  // The guest's stream for a connection has arrived, which may be before or after the connection was opened
+  attach(id, stream) {
+    const entry = this.stream(id);
+    entry.writer = stream.writable.getWriter();
+    for (const data of entry.pending.splice(0)) {
+      this.write(entry, data);
+    }
+    if (entry.finished) {
+      this.end(id);
+    }
+  }
+
+  // The connection was opened (what StreamScheduler.setWeight() means to the handlers)
+  setWeight(id) {
+    this.stream(id);
+  }
+
+  push(id, data, bytes) {
+    const entry = this.streams.get(id);
+    if (!entry || entry.finished) {
+      return;
+    }
+    entry.bytes += bytes;
+    if (entry.writer) {
+      this.write(entry, data);
+    } else {
+      entry.pending.push(data);
+    }
+  }
+
+  write(entry, data) {
+    entry.writer.write(data).then(() => {
+      entry.bytes -= data.length;
+      if (entry.waiter && entry.bytes <= entry.waiter.bytes) {
+        const { fn } = entry.waiter;
+        entry.waiter = null;
+        fn();
+      }
+    }, () => {});
+  }
+
+  queued(id) {
+    const entry = this.streams.get(id);
+    return entry ? entry.bytes : 0;
+  }
+
+  whenBelow(id, bytes, fn) {
+    this.stream(id).waiter = { bytes, fn };
+  }
+
+  // The connection ended at the proxy's end: the stream ends once what was written has gone, errors are also reported
+  // as a message
+  finish(id, message) {
+    if (message.t === 'error') {
+      this.send(JSON.stringify(message));
+    }
+    const entry = this.streams.get(id);
+    if (entry) {
+      entry.finished = true;
+      if (entry.writer) {
+        this.end(id);
+      }
+    }
+  }
+
+  end(id) {
+    const entry = this.streams.get(id);
+    this.streams.delete(id);
+    entry.writer.close().catch(() => {});
+  }
+
+  // The guest closed the connection, or it is gone
+  drop(id) {
+    const entry = this.streams.get(id);
+    if (entry && entry.writer) {
+      this.end(id);
+    } else if (entry) {
+      entry.finished = true;
+    }
+  }
+
+  stop() {
+    this.readyState = WebSocket.CLOSED;
+    this.streams.clear();
+  }
+
+  close(code, reason) {
+    this.stop();
+    try {
+      this.session.close({ closeCode: code, reason });
+    } catch (err) {
+      // Already closed
+    }
+  }
+}
+
+// =============================================================================
+// Resumable Socket - A guest's session across WebSockets
+// =============================================================================
+
+// Acknowledge what arrived once this much has, or this long after the first unacknowledged frame
+const ACK_BYTES = 64 * 1024;
+const ACK_DELAY = 100;
+
+/**
+ * A guest's WebSocket, as the handlers see it. It can outlive the WebSocket: while suspended (the WebSocket is gone,
+ * the guest may come back with a new one), what is sent is kept, and once resumed it goes out on the new WebSocket.
+ *
+ * Both ends count the messages they send and receive, except {t: 'ack'} and {t: 'session'}, and acknowledge
+ * {t: 'ack', n} what they received every ACK_BYTES or ACK_DELAY. Until acknowledged, a message is kept for sending
+ * again (the replay buffer). While the buffer holds replayBytes, backlog tells the scheduler to hold back, so a guest
+ * that stops acknowledging holds up only itself. Resuming, each end says how many messages it has received, and the
+ * other sends again what came after: data on connections and control messages alike pick up where they broke off.
+ *
+ * Without ?session=new (clients that predate resumption), nothing is kept and the session ends with its WebSocket.
+ */
+class ResumableSocket {
+  constructor(ws, token, replayBytes) {
+    this.ws = ws;
+    this.token = token;             // Null if not resumable
+    this.replayBytes = replayBytes;
+    this.readyState = WebSocket.OPEN;
+    this.sent = 0;                  // Messages sent, counted
+    this.received = 0;              // Messages received from the guest, counted
+    this.replay = [];               // Sent and not acknowledged, oldest first
+    this.replayed = 0;              // Their bytes
+    this.unacked = 0;               // Bytes received since the last {t: 'ack'} to the guest
+    this.ackTimer = null;
+  }
+
+  get bufferedAmount() {
+    return this.ws ? this.ws.bufferedAmount : 0;
+  }
+
+  // What the scheduler goes by: the WebSocket's buffer, or too much unless frames can go out now
+  get backlog() {
+    if (!this.ws || (this.token && this.replayed >= this.replayBytes)) {
+      return Infinity;
+    }
+    return this.ws.bufferedAmount;
+  }
+
+  /**
+   * Send a message, or [header, data] for one binary message whose parts go as two fragments. ws writes a fragment's
+   * frame header and its payload to the socket together without copying the payload (frames from a server are not
+   * masked), so the data goes out from the buffer it came in.
+   */
+  send(frame) {
+    if (this.readyState !== WebSocket.OPEN) {
+      return;
+    }
+    if (this.token) {
+      this.sent++;
+      this.replay.push(frame);
+      this.replayed += frameBytes(frame);
+    }
+    if (this.ws) {
+      this.write(frame);
+    }
+  }
+
+  write(frame) {
+    if (this.ws.readyState !== WebSocket.OPEN) {
+      return;
+    }
+    if (Array.isArray(frame)) {
+      this.ws.send(frame[0], { fin: false });
+      this.ws.send(frame[1]);
+    } else {
+      this.ws.send(frame);
+    }
+  }
+
+  // A message outside the count
+  control(message) {
+    if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+      this.ws.send(JSON.stringify(message));
+    }
+  }
+
+  // The guest has received n messages, they need not be kept
+  ack(n) {
+    for (let i = n - (this.sent - this.replay.length); i > 0 && this.replay.length; i--) {
+      this.replayed -= frameBytes(this.replay.shift());
+    }
+  }
+
+  // A message has arrived from the guest, acknowledge it in a while
+  noteReceived(bytes) {
+    if (!this.token) {
+      return;
+    }
+    this.received++;
+    this.unacked += bytes;
+    if (this.unacked >= ACK_BYTES) {
+      this.sendAck();
+    } else if (!this.ackTimer) {
+      this.ackTimer = setTimeout(() => this.sendAck(), ACK_DELAY);
+    }
+  }
+
+  sendAck() {
+    clearTimeout(this.ackTimer);
+    this.ackTimer = null;
+    this.unacked = 0;
+    this.control({ t: 'ack', n: this.received });
+  }
+
+  suspend() {
+    this.ws = null;
+    clearTimeout(this.ackTimer);
+    this.ackTimer = null;
+  }
+
+  /**
+   * Carry on over a new WebSocket, the guest having received the first received messages
+   * @returns {boolean} False if what the guest is missing is no longer kept
+   */
+  resume(ws, received) {
+    if (!(received >= this.sent - this.replay.length && received <= this.sent)) {
+      return false;
+    }
+    this.ack(received);
+    this.ws = ws;
+    this.control({ t: 'session', token: this.token, resumed: true, received: this.received });
+    for (const frame of this.replay) {
+      this.write(frame);
+    }
+    return true;
+  }
+
+  close() {
+    this.readyState = WebSocket.CLOSED;
+    this.suspend();
+    this.replay = [];
+  }
+}
+
+function frameBytes(frame) {
+  return Array.isArray(frame) ? frame[1].length : frame.length;
+}
+
+// =============================================================================
+// Authenticator
+// =============================================================================
+
+class Authenticator {
+  constructor(config) {
+    this.config = config;
+  }
+
+  authenticate(request) {
+    if (!this.config.enabled) {
+      return { authenticated: true, userId: 'anonymous' };
+    }
+
+    // Try JWT from query parameter (WebSocket can't set headers easily)
+    const url = new URL(request.url, `http://${request.headers.host}`);
+    const token = url.searchParams.get('token');
+    if (token) {
+      return this.authenticateToken(token);
+    }
+
+    // Try Authorization header
+    const authHeader = request.headers['authorization'];
+    if (authHeader && authHeader.startsWith('Bearer ')) {
+      return this.authenticateToken(authHeader.substring(7));
+    }
+
+    return { authenticated: false, error: 'No valid authentication provided' };
+  }
+
+  // A JWT on its own, as a WebTransport guest sends it in its first message
+  authenticateToken(token) {
+    if (!this.config.enabled) {
+      return { authenticated: true, userId: 'anonymous' };
+    }
+
+    if (token && jwt) {
+      try {
+        const decoded = jwt.verify(token, this.config.jwtSecret);
+        return { authenticated: true, userId: decoded.sub || decoded.userId || 'jwt-user' };
+      } catch (err) {
+        return { authenticated: false, error: 'Invalid JWT token' };
+      }
+    }
+
+    return { authenticated: false, error: 'No valid authentication provided' };
+  }
+}
+
+// =============================================================================
+// Metrics - Counters, gauges and histograms in the Prometheus text format
+// =============================================================================
+
+function formatLabels(labels) {
+  return Object.entries(labels)
+    .map(([name, value]) => `${name}="${String(value).replace(/[\\"\n]/g, (c) => c === '\n' ? '\\n' : '\\' + c)}"`)
+    .join(',');
+}
+
+/**
+ * A metric with its values per set of labels. labels() returns the value for one set, to keep in hot paths instead
+ * of looking it up every time.
+ */
+class Metric {
+  constructor(type, name, help, options = {}) {
+    this.type = type;
+    this.name = name;
+    this.help = help;
+    this.merge = options.merge || 'sum';  // How values of several processes combine: 'sum' or 'max'
+    this.collect = options.collect || null;  // Called before a snapshot, to set values that are read, not counted
+    this.children = new Map();
+  }
+
+  labels(labels = {}) {
+    const key = formatLabels(labels);
+    let child = this.children.get(key);
+    if (!child) {
+      child = this.create();
+      this.children.set(key, child);
+    }
+    return child;
+  }
+
+  // Samples as [name, labels, value]
+  samples() {
+    const samples = [];
+    for (const [labels, child] of this.children) {
+      samples.push([this.name, labels, child.value]);
+    }
+    return samples;
+  }
+}
+
+class Counter extends Metric {
+  constructor(name, help, options) {
+    super('counter', name, help, options);
+  }
+
+  create() {
+    return { value: 0, inc(n = 1) { this.value += n; } };
+  }
+
+  inc(n = 1) {
+    this.labels().inc(n);
+  }
+}
+
+class Gauge extends Metric {
+  constructor(name, help, options) {
+    super('gauge', name, help, options);
+  }
+
+  create() {
+    return { value: 0, set(value) { this.value = value; } };
+  }
+
+  set(value) {
+    this.labels().set(value);
+  }
+}
+
+class Histogram extends Metric {
+  constructor(name, help, buckets, options) {
+    super('histogram', name, help, options);
+    this.buckets = buckets;
+  }
+
+  create() {
+    const buckets = this.buckets;
+    return {
+      counts: new Array(buckets.length).fill(0),
+      sum: 0,
+      count: 0,
+      observe(value) {
+        for (let i = 0; i < buckets.length; i++) {
+          if (value <= buckets[i]) {
+            this.counts[i]++;
+            break;
+          }
+        }
+        this.sum += value;
+        this.count++;
+      },
+    };
+  }
+
+  observe(value) {
+    this.labels().observe(value);
+  }
+
+  samples() {
+    const samples = [];
+    for (const [labels, child] of this.children) {
+      const prefix = labels ? labels + ',' : '';
+      let cumulative = 0;
+      this.buckets.forEach((le, i) => {
+        cumulative += child.counts[i];
+        samples.push([this.name + '_bucket', `${prefix}le="${le}"`, cumulative]);
+      });
+      samples.push([this.name + '_bucket', `${prefix}le="+Inf"`, child.count]);
+      samples.push([this.name + '_sum', labels, child.sum]);
+      samples.push([this.name + '_count', labels, child.count]);
+    }
+    return samples;
+  }
+}
+
+// Latency buckets, in seconds
+const LATENCY_BUCKETS = [0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30];
+
+class Metrics {
+  constructor() {
+    this.metrics = [];
+  }
+
+  counter(name, help, options) {
+    return this.register(new Counter(name, help, options));
+  }
+
+  gauge(name, help, options) {
+    return this.register(new Gauge(name, help, options));
+  }
+
+  histogram(name, help, buckets = LATENCY_BUCKETS, options) {
+    return this.register(new Histogram(name, help, buckets, options));
+  }
+
+  register(metric) {
+    this.metrics.push(metric);
+    return metric;
+  }
+
+  // Memory and event loop lag of this process
+  registerProcess() {
+    // The delays it records include the resolution, the timer period it measures with.
+    const resolution = 10;
+    const lag = monitorEventLoopDelay({ resolution });
+    lag.enable();
+    const seconds = (ns) => Math.max(0, ns / 1e6 - resolution) / 1000;
+
+    this.gauge('lwproxy_memory_bytes', 'Memory use, from process.memoryUsage()', {
+      collect: (gauge) => {
+        for (const [kind, bytes] of Object.entries(process.memoryUsage())) {
+          gauge.labels({ kind }).set(bytes);
+        }
+      },
+    });
+    this.gauge('lwproxy_event_loop_lag_seconds', 'Event loop delay since the last scrape, worst process', {
+      merge: 'max',
+      collect: (gauge) => {
+        gauge.labels({ quantile: '0.5' }).set(seconds(lag.percentile(50)));
+        gauge.labels({ quantile: '0.99' }).set(seconds(lag.percentile(99)));
+        gauge.labels({ quantile: '1' }).set(seconds(lag.max));
+        lag.reset();
+      },
+    });
+  }
+
+  /**
+   * Current values, in a form that can cross process boundaries
+   * @returns {Array<{name, help, type, merge, samples}>}
+   */
+  snapshot() {
+    return this.metrics.map((metric) => {
+      if (metric.collect) {
+        metric.collect(metric);
+      }
+      return { name: metric.name, help: metric.help, type: metric.type, merge: metric.merge, samples: metric.samples() };
+    });
+  }
+
+  /**
+   * Render snapshots, of one process or several (a cluster), as one exposition
+   */
+  static render(snapshots) {
+    const families = new Map();
+    for (const snapshot of snapshots) {
+      for (const family of snapshot) {
+        if (!families.has(family.name)) {
+          families.set(family.name, { ...family, values: new Map() });
+        }
+        const merged = families.get(family.name);
+        for (const [name, labels, value] of family.samples) {
+          const key = labels ? `${name}{${labels}}` : name;
+          const previous = merged.values.get(key);
+          merged.values.set(key, previous === undefined ? value
+            : merged.merge === 'max' ? Math.max(previous, value) : previous + value);
+        }
+      }
+    }
+
+    const lines = [];
+    for (const family of families.values()) {
+      lines.push(`# HELP ${family.name} ${family.help}`);
+      lines.push(`# TYPE ${family.name} ${family.type}`);
+      for (const [key, value] of family.values) {
+        lines.push(`${key} ${value}`);
+      }
+    }
+    return lines.join('\n') + '\n';
+  }
+}
+
+// =============================================================================
+// Logger
+// =============================================================================
+
+/**
+ * One JSON line per event, as before, but written to stdout in batches once per turn of the event loop instead of
+ * a write per event, which blocked the relay under load (stdout is synchronous for files and pipes).
+ */
+class Logger {
+  constructor(config = CONFIG.logging, metrics = new Metrics()) {
+    this.config = config;
+    this.pending = [];
+    this.pendingBytes = 0;
+    this.scheduled = false;
+    this.events = metrics.counter('lwproxy_events_total', 'Logged events, sampled out or not');
+    this.dropped = metrics.counter('lwproxy_log_dropped_total', 'Log lines dropped because stdout fell behind');
+    process.on('exit', () => this.flush());
+  }
+
+  log(level, userId, action, details = {}) {
+    this.events.labels({ action }).inc();
+    if (level === 'INFO' && this.config.sampleRate < 1 && Math.random() >= this.config.sampleRate) {
+      return;
+    }
+
+    const entry = {
+      timestamp: new Date().toISOString(),
+      level,
+      userId,
+      action,
+      ...details,
+    };
+    const line = JSON.stringify(entry) + '\n';
+
+    if (this.pendingBytes + process.stdout.writableLength > this.config.maxPendingBytes) {
+      this.dropped.inc();
+      return;
+    }
+    this.pending.push(line);
+    this.pendingBytes += line.length;
+
+    if (!this.scheduled) {
+      this.scheduled = true;
+      setImmediate(() => this.flush());
+    }
+  }
+
+  flush() {
+    this.scheduled = false;
+    if (this.pending.length) {
+      process.stdout.write(this.pending.join(''));
+      this.pending = [];
+      this.pendingBytes = 0;
+    }
+  }
+
+  info(userId, action, details) {
+    this.log('INFO', userId, action, details);
+  }
+
+  error(userId, action, error) {
+    this.log('ERROR', userId, action, { error: error.message || error });
+  }
+}
+
+// =============================================================================
+// WebSocket Proxy Server
+// =============================================================================
+
+class WSProxyServer {
+  /**
+   * @param {Object} config - CONFIG
+   * @param {Object} [options] - dnsResolver and connector to use instead of the real ones (bench/test-proxy.js)
+   */
+  constructor(config, options = {}) {
+    this.config = config;
+    this.metrics = new Metrics();
+    this.metrics.registerProcess();
+    this.ipValidator = new IPValidator(config.blockedCIDRs);
+    this.rateLimiter = cluster.isWorker
+      ? new ClusterRateLimiter(config.rateLimits, config.cluster.leaseBytes)
+      : new RateLimiter(config.rateLimits);
+    this.dnsResolver = options.dnsResolver || new DNSResolver(config.dnsCache, this.ipValidator, this.metrics);
+    this.connector = options.connector || new Connector(config.connect, config.rateLimits.connectionTimeout);
+    this.authenticator = new Authenticator(config.auth);
+    this.logger = new Logger(config.logging, this.metrics);
+    this.sessions = new Set();  // { ws, clientConnections, userId, ... } of every guest
+    this.schedulers = new WeakMap();  // ws -> StreamScheduler for what goes to the guest (WebTransport: itself)
+    this.webTransport = null;  // { url path, certificateHashes } once serving WebTransport
+    this.resumable = new Map();  // Session token -> session, of guests that may come back on a new WebSocket
+    this.registerMetrics();
+  }
+
+  registerMetrics() {
+    const metrics = this.metrics;
+
+    const openSeconds = metrics.histogram('lwproxy_connection_open_seconds',
+      'From the guest asking to the connection being usable (for HTTP, to the response headers)');
+    this.openTcp = openSeconds.labels({ kind: 'tcp' });
+    this.openHttp = openSeconds.labels({ kind: 'http' });
+
+    const bytes = metrics.counter('lwproxy_bytes_total', 'Bytes relayed, upstream is from the guest');
+    this.bytesUpstream = bytes.labels({ direction: 'upstream' });
+    this.bytesDownstream = bytes.labels({ direction: 'downstream' });
+
+    this.rejections = metrics.counter('lwproxy_rate_limit_rejections_total', 'Refused by a rate limit, by limit');
+
+    // Read when scraped rather than kept up to date on every change
+    const sum = (f) => [...this.sessions].reduce((total, session) => total + f(session), 0);
+    metrics.gauge('lwproxy_websockets', 'Open guest WebSockets and WebTransport sessions', {
+      collect: (gauge) => gauge.set(this.sessions.size),
+    });
+    metrics.gauge('lwproxy_active_connections', 'Open guest connections, TCP and HTTP', {
+      collect: (gauge) => gauge.set(sum((session) => session.clientConnections.size)),
+    });
+    metrics.gauge('lwproxy_ws_buffered_bytes', 'Bytes queued on guest WebSockets', {
+      collect: (gauge) => gauge.set(sum((session) => session.ws.bufferedAmount)),
+    });
+    metrics.gauge('lwproxy_ws_buffered_bytes_max', 'Most bytes queued on one guest WebSocket', {
+      merge: 'max',
+      collect: (gauge) => gauge.set(Math.max(0, ...[...this.sessions].map((session) => session.ws.bufferedAmount))),
+    });
+
+    if (!cluster.isWorker) {
+      this.rateLimiter.registerMetrics(metrics);
+    }
+  }
+
+  /**
+   * Snapshots for /metrics: this process, or in a cluster every process (through the primary)
+   * @returns {Promise<Array>}
+   */
+  collectMetrics() {
+    if (!cluster.isWorker) {
+      return Promise.resolve([this.metrics.snapshot()]);
+    }
+    return new Promise((resolve) => {
+      const id = this.nextMetricsId = (this.nextMetricsId || 0) + 1;
+      const onMessage = (msg) => {
+        if (msg && msg.t === 'metrics' && msg.id === id) {
+          process.removeListener('message', onMessage);
+          resolve(msg.snapshots);
+        }
+      };
+      process.on('message', onMessage);
+      process.send({ t: 'metrics', id });
+    });
+  }
+
+  start() {
+    const server = http.createServer((req, res) => {
+      // Health check endpoint
+      if (req.url === '/health') {
+        res.writeHead(200, { 'Content-Type': 'text/plain' });
+        res.end('OK');
+        return;
+      }
+
+      // Prometheus metrics
+      if (req.url === '/metrics') {
+        if (this.config.metricsToken && req.headers.authorization !== `Bearer ${this.config.metricsToken}`) {
+          res.writeHead(401);
+          res.end('Unauthorized');
+          return;
+        }
+        this.collectMetrics().then((snapshots) => {
+          res.writeHead(200, { 'Content-Type': 'text/plain; version=0.0.4' });
+          res.end(Metrics.render(snapshots));
+        });
+        return;
+      }
+
+      // Memory use and the size of per user state, to watch for growth. In a cluster, of the worker that answers.
+      if (req.url === '/stats') {
+        res.writeHead(200, { 'Content-Type': 'application/json' });
+        res.end(JSON.stringify(this.stats()));
+        return;
+      }
+
+      // Where the WebTransport endpoint is, for the guest to try before the WebSocket
+      if (req.url === '/webtransport') {
+        res.writeHead(200, { 'Content-Type': 'application/json', 'Access-Control-Allow-Origin': '*' });
+        res.end(JSON.stringify(this.webTransport ? {
+          url: `https://${new URL(`http://${req.headers.host}`).hostname}:${this.config.webTransport.port}` +
+            this.webTransport.path,
+          certificateHashes: this.webTransport.certificateHashes,
+        } : { url: null }));
+        return;
+      }
+
+      // CORS preflight
+      if (req.method === 'OPTIONS') {
+        res.writeHead(204, {
+          'Access-Control-Allow-Origin': '*',
+          'Access-Control-Allow-Methods': 'GET, OPTIONS',
+          'Access-Control-Allow-Headers': 'Authorization',
+        });
+        res.end();
+        return;
+      }
+
+      res.writeHead(404);
+      res.end('Not found');
+    });
+
+    const wss = new WebSocket.Server({ server });
 
     wss.on('connection', (ws, request) => this.handleConnection(ws, request));
 
+    // Workers do not listen, the primary hands them connections (see startCluster()).
+    if (cluster.isWorker) {
+      process.on('message', (msg) => {
+        if (msg && msg.t === 'metrics-collect') {
+          process.send({ t: 'metrics-snapshot', id: msg.id, snapshot: this.metrics.snapshot() });
+        }
+      });
+
+      const handedOver = new Map();
+      process.on('message', (msg, socket) => {
+        if (!msg || msg.t !== 'sticky') {
+          return;
+        }
+
+        // The primary reads on its copy of the socket until it has closed it, which it confirms. Only then is it
+        // safe to answer, or what the client sends next could end up there.
+        if (socket) {
+          handedOver.set(msg.id, { socket, head: msg.head });
+          process.send({ t: 'sticky', id: msg.id });
+        } else if (handedOver.has(msg.id)) {
+          const { socket, head } = handedOver.get(msg.id);
+          handedOver.delete(msg.id);
+          socket.unshift(Buffer.from(head, 'base64'));
+          server.emit('connection', socket);
+          socket.resume();
+        }
+      });
+      return server;
+    }
+
+    if (this.config.webTransport.port) {
+      this.startWebTransport().catch((err) => {
+        console.error(`WebTransport not available: ${err.message}`);
+      });
+    }
+
     server.listen(this.config.port, () => {
       console.log(`WebSocket proxy server listening on port ${this.config.port}`);
       console.log(`Auth enabled: ${this.config.auth.enabled}`);
@@ -363,6 +1793,14 @@ class WSProxyServer {
     return server;
   }
 
+  stats() {
+    return {
+      memory: process.memoryUsage(),
+      rateLimiter: this.rateLimiter.metrics(),
+      dnsCache: this.dnsResolver.metrics(),
+    };
+  }
+
   handleConnection(ws, request) {
     // Authenticate
     const auth = this.authenticator.authenticate(request);
@@ -373,31 +1811,97 @@ class WSProxyServer {
     }
 
     const userId = auth.userId;
-    const clientConnections = new Map();
+    const params = new URL(request.url, `http://${request.headers.host}`).searchParams;
+    const ip = request.socket.remoteAddress;
+
+    // Back after losing its WebSocket: the session carries on, on this one
+    const previous = this.resumable.get(params.get('session'));
+    if (previous && previous.userId === userId) {
+      const guest = previous.ws;
+      const old = guest.ws;
+      if (guest.resume(ws, parseInt(params.get('received'), 10))) {
+        if (old) {
+          old.terminate();  // Not noticed gone yet at this end
+        }
+        clearTimeout(previous.graceTimer);
+        this.attachWebSocket(ws, request.socket, previous);
+        this.schedulers.get(guest).pump();
+        this.logger.info(userId, 'WS_RESUMED', { ip });
+        return;
+      }
+    }
+
+    // A new session, resumable if asked for
+    const resumable = params.has('session') && this.config.resume.grace > 0;
+    const token = resumable
+      ? `${process.env.WORKER_INDEX || 0}.${crypto.randomBytes(16).toString('base64url')}`
+      : null;
+    const guest = new ResumableSocket(ws, token, this.config.resume.replayBytes);
+    const session = { ws: guest, clientConnections: new Map(), userId, token, graceTimer: null };
+    this.sessions.add(session);
+    if (token) {
+      this.resumable.set(token, session);
+      guest.control({ t: 'session', token, resumed: false, grace: this.config.resume.grace });
+    }
+
+    const scheduler = new StreamScheduler({
+      chunkSize: this.config.streams.chunkSize,
+      highWater: this.config.streams.highWaterBytes,
+      send: (frame) => guest.send(frame),
+      bufferedAmount: () => guest.backlog,
+    });
+    this.schedulers.set(guest, scheduler);
+
+    this.logger.info(userId, 'WS_CONNECTED', { ip });
+    this.attachWebSocket(ws, request.socket, session);
+  }
+
+  // socket is the one ws writes to, whose 'drain' lets the scheduler carry on
+  attachWebSocket(ws, socket, session) {
+    const { ws: guest, userId, clientConnections } = session;
+    const scheduler = this.schedulers.get(guest);
 
-    this.logger.info(userId, 'WS_CONNECTED', { ip: request.socket.remoteAddress });
+    socket.on('drain', () => scheduler.pump());
 
-    ws.on('message', async (data) => {
+    ws.on('message', async (data, isBinary) => {
       try {
+        // Data for a connection: its 4-byte big-endian ID, then the data (written as is, not copied)
+        if (isBinary) {
+          guest.noteReceived(data.length);
+          this.writeUpstream(guest, userId, data.readUInt32BE(0), data.subarray(4), clientConnections);
+          return;
+        }
+
         const msg = JSON.parse(data.toString());
-        await this.handleMessage(ws, userId, msg, clientConnections);
+        if (msg.t === 'ack') {
+          guest.ack(msg.n);
+          scheduler.pump();  // Room in the replay buffer
+          return;
+        }
+        guest.noteReceived(data.length);
+        await this.handleMessage(guest, userId, msg, clientConnections);
       } catch (err) {
         this.logger.error(userId, 'MESSAGE_ERROR', err);
-        ws.send(JSON.stringify({ t: 'error', msg: err.message }));
+        guest.send(JSON.stringify({ t: 'error', msg: err.message }));
       }
     });
 
     ws.on('close', () => {
+      if (guest.ws !== ws) {
+        return;  // Replaced by the WebSocket the session was resumed on
+      }
       this.logger.info(userId, 'WS_DISCONNECTED', {});
-
-      // Clean up all TCP connections
-      for (const [connId, conn] of clientConnections) {
-        if (conn.socket) {
-          conn.socket.destroy();
-        }
-        this.rateLimiter.recordDisconnection(userId);
+      if (!session.token) {
+        this.endSession(session, userId);
+        return;
       }
-      clientConnections.clear();
+
+      // The connections stay until the guest is back or the grace period is over
+      guest.suspend();
+      session.graceTimer = setTimeout(() => {
+        this.logger.info(userId, 'SESSION_EXPIRED', {});
+        this.endSession(session, userId);
+      }, this.config.resume.grace);
     });
 
     ws.on('error', (err) => {
@@ -405,17 +1909,212 @@ class WSProxyServer {
     });
   }
 
+  // The guest has gone, on either transport
+  endSession(session, userId) {
+    this.sessions.delete(session);
+    this.schedulers.get(session.ws).stop();
+    session.ws.close();
+    if (session.token) {
+      this.resumable.delete(session.token);
+      clearTimeout(session.graceTimer);
+    }
+
+    // Clean up all TCP connections
+    for (const [connId, conn] of session.clientConnections) {
+      if (conn.socket) {
+        conn.socket.destroy();
+      }
+      this.rateLimiter.recordDisconnection(userId);
+    }
+    session.clientConnections.clear();
+  }
+
+  /**
+   * Serve WebTransport on config.webTransport.port (UDP), next to the WebSocket
+   *
+   * Sessions are at /proxy. The guest opens a bidirectional stream for control messages and sends
+   * {t: 'hello', token} on it first, the JWT it would have put in the WebSocket URL; it is answered {t: 'ready'}.
+   * See WebTransportSession for the rest.
+   */
+  async startWebTransport() {
+    const { port, cert, key } = this.config.webTransport;
+    if (!cert || !key) {
+      throw new Error('WEBTRANSPORT_CERT and WEBTRANSPORT_KEY must be set');
+    }
+    const certificate = fs.readFileSync(cert, 'utf8');
+    const privateKey = fs.readFileSync(key, 'utf8');
+
+    const { Http3Server } = await import(WEBTRANSPORT_MODULE);
+    const h3 = new Http3Server({
+      port,
+      host: '::',
+      secret: crypto.randomBytes(32).toString('hex'),
+      cert: certificate,
+      privKey: privateKey,
+    });
+    h3.startServer();
+
+    // Browsers accept a certificate by its hash instead of a CA only if it is valid for at most 14 days (a
+    // self-signed one for local testing). Offered to guests for such a certificate, which they cannot check otherwise.
+    const x509 = new crypto.X509Certificate(certificate);
+    const shortLived = new Date(x509.validTo) - new Date(x509.validFrom) <= 14 * 24 * 3600 * 1000;
+    this.webTransport = {
+      path: '/proxy',
+      certificateHashes: shortLived ? [crypto.createHash('sha256').update(x509.raw).digest('base64')] : null,
+    };
+    console.log(`WebTransport listening on UDP port ${port}` + (shortLived ? ' (certificate offered by hash)' : ''));
+
+    const sessions = (await h3.sessionStream(this.webTransport.path)).getReader();
+    for (;;) {
+      const { done, value } = await sessions.read();
+      if (done) {
+        break;
+      }
+      this.handleWebTransportSession(value).catch((err) => {
+        this.logger.error('unknown', 'WT_ERROR', err);
+      });
+    }
+  }
+
+  async handleWebTransportSession(session) {
+    await session.ready;
+    const streams = session.incomingBidirectionalStreams.getReader();
+    const { value: control } = await streams.read();
+    if (!control) {
+      return;
+    }
+    const lines = readLines(control.readable);
+    const wt = new WebTransportSession(session, control);
+
+    // Authenticate
+    const hello = await lines.next();
+    let auth;
+    try {
+      const msg = JSON.parse(hello.value);
+      auth = msg.t === 'hello' ? this.authenticator.authenticateToken(msg.token)
+        : { authenticated: false, error: 'Expected hello' };
+    } catch (err) {
+      auth = { authenticated: false, error: 'Expected hello' };
+    }
+    if (!auth.authenticated) {
+      this.logger.error('unknown', 'AUTH_FAILED', new Error(auth.error));
+      wt.close(4001, auth.error);
+      return;
+    }
+
+    const userId = auth.userId;
+    const clientConnections = new Map();
+    const sessionEntry = { ws: wt, clientConnections, userId };
+    this.sessions.add(sessionEntry);
+    this.schedulers.set(wt, wt);
+    this.logger.info(userId, 'WT_CONNECTED', {});
+    wt.send(JSON.stringify({ t: 'ready' }));
+
+    // A stream per connection
+    (async () => {
+      for (;;) {
+        const { done, value } = await streams.read();
+        if (done) {
+          break;
+        }
+        this.readWebTransportStream(wt, userId, value, clientConnections);
+      }
+    })().catch(() => {});
+
+    const end = () => {
+      if (this.sessions.has(sessionEntry)) {
+        this.endSession(sessionEntry, userId);
+        this.logger.info(userId, 'WT_DISCONNECTED', {});
+      }
+    };
+    session.closed.catch(() => {}).then(end);
+
+    try {
+      for await (const line of lines) {
+        try {
+          await this.handleMessage(wt, userId, JSON.parse(line), clientConnections);
+        } catch (err) {
+          this.logger.error(userId, 'MESSAGE_ERROR', err);
+          wt.send(JSON.stringify({ t: 'error', msg: err.message }));
+        }
+      }
+    } catch (err) {
+      // Control stream reset, the session is going
+    }
+    wt.close(0, 'Control stream closed');
+    end();
+  }
+
+  /**
+   * A guest's stream for one connection: the connection ID, then data to write to it, until the guest is done
+   * writing (which closes the connection, like {t: 'close'})
+   */
+  async readWebTransportStream(wt, userId, stream, clientConnections) {
+    const reader = stream.readable.getReader();
+    let id = null;
+    let head = Buffer.alloc(0);
+    try {
+      for (;;) {
+        const { done, value } = await reader.read();
+        if (done) {
+          break;
+        }
+        let data = Buffer.from(value.buffer, value.byteOffset, value.byteLength);
+        if (id === null) {
+          head = Buffer.concat([head, data]);
+          if (head.length < 4) {
+            continue;
+          }
+          id = head.readUInt32BE(0);
+          wt.attach(id, stream);
+          data = head.subarray(4);
+        }
+
+        if (data.length && !this.writeUpstream(wt, userId, id, data, clientConnections)) {
+          // Stop reading (QUIC flow control holds the guest back) until the upstream socket takes more
+          const { socket } = clientConnections.get(id);
+          if (!socket.destroyed) {
+            await new Promise((resolve) => {
+              const done = () => {
+                socket.off('drain', done);
+                socket.off('close', done);
+                resolve();
+              };
+              socket.on('drain', done);
+              socket.on('close', done);
+            });
+          }
+        }
+      }
+    } catch (err) {
+      // Reset by the guest
+    }
+
+    if (id !== null && wt.readyState === WebSocket.OPEN) {
+      this.handleClose(wt, userId, { id }, clientConnections);
+      wt.drop(id);
+    }
+  }
+
   async handleMessage(ws, userId, msg, clientConnections) {
     switch (msg.t) {
       case 'open':
         await this.handleOpen(ws, userId, msg, clientConnections);
         break;
-      case 'write':
+      case 'write':  // Base64, from clients that predate binary messages
         this.handleWrite(ws, userId, msg, clientConnections);
         break;
       case 'close':
         this.handleClose(ws, userId, msg, clientConnections);
         break;
+      case 'http':
+        await this.handleHttp(ws, userId, msg, clientConnections);
+        break;
+      case 'priority':
+        if (clientConnections.has(msg.id)) {
+          this.setWeight(ws, msg.id, msg.weight);
+        }
+        break;
       default:
         ws.send(JSON.stringify({ t: 'error', id: msg.id, msg: 'Unknown message type' }));
     }
@@ -423,6 +2122,7 @@ class WSProxyServer {
 
   async handleOpen(ws, userId, msg, clientConnections) {
     const { id, host, port } = msg;
+    const started = performance.now();
 
     // SECURITY: Validate port
     if (!this.config.allowedPorts.includes(port)) {
@@ -431,9 +2131,10 @@ class WSProxyServer {
       return;
     }
 
-    // SECURITY: Rate limit check
-    const rateCheck = this.rateLimiter.canConnect(userId);
+    // SECURITY: Rate limit check, which holds a connection from here on
+    const rateCheck = await this.rateLimiter.reserveConnection(userId);
     if (!rateCheck.allowed) {
+      this.rejections.labels({ limit: rateCheck.limit }).inc();
       this.logger.info(userId, 'RATE_LIMITED', { host, port, reason: rateCheck.reason });
       ws.send(JSON.stringify({ t: 'error', id, msg: rateCheck.reason }));
       return;
@@ -444,6 +2145,7 @@ class WSProxyServer {
     try {
       resolved = await this.dnsResolver.resolveAndValidate(host);
     } catch (err) {
+      this.rateLimiter.recordDisconnection(userId);
       this.logger.info(userId, 'DNS_BLOCKED', { host, port, error: err.message });
       ws.send(JSON.stringify({ t: 'error', id, msg: err.message }));
       return;
@@ -452,109 +2154,357 @@ class WSProxyServer {
     // Create TCP connection (use TLS for port 443)
     const useTLS = port === 443;
     let socket;
-
-    if (useTLS) {
-      socket = tls.connect({
-        host: resolved.ip,
-        port: port,
-        servername: host,  // SNI
-        rejectUnauthorized: true,
-      });
-    } else {
-      socket = new net.Socket();
-      socket.connect(port, resolved.ip);
+    try {
+      socket = await this.connector.connect(resolved.addresses, port, useTLS ? host : null);
+    } catch (err) {
+      this.rateLimiter.recordDisconnection(userId);
+      this.logger.info(userId, 'CONNECT_FAILED', { host, port, error: err.message });
+      ws.send(JSON.stringify({ t: 'error', id, msg: err.message }));
+      return;
     }
 
-    const timeout = setTimeout(() => {
+    // The guest may have gone while this connected, and with it the cleanup of its connections
+    if (ws.readyState !== WebSocket.OPEN) {
       socket.destroy();
-      this.logger.info(userId, 'CONNECT_TIMEOUT', { host, port });
-      ws.send(JSON.stringify({ t: 'error', id, msg: 'Connection timeout' }));
-    }, this.config.rateLimits.connectionTimeout);
-
-    const onConnect = () => {
-      clearTimeout(timeout);
-
-      this.rateLimiter.recordConnection(userId);
-      clientConnections.set(id, {
-        socket,
-        host,
-        port,
-        ip: resolved.ip,
-        useTLS,
-      });
+      this.rateLimiter.recordDisconnection(userId);
+      return;
+    }
 
-      this.logger.info(userId, 'CONNECTED', { host, port, ip: resolved.ip, tls: useTLS });
-      ws.send(JSON.stringify({ t: 'opened', id }));
+    const ip = socket.remoteAddress;
+    this.setWeight(ws, id, msg.weight);
+    clientConnections.set(id, {
+      socket,
+      host,
+      port,
+      ip,
+      useTLS,
+    });
 
-      // Set idle timeout
-      socket.setTimeout(this.config.rateLimits.idleTimeout, () => {
-        this.logger.info(userId, 'IDLE_TIMEOUT', { host, port });
-        socket.destroy();
-      });
-    };
+    this.openTcp.observe((performance.now() - started) / 1000);
+    this.logger.info(userId, 'CONNECTED', { host, port, ip, tls: useTLS });
+    ws.send(JSON.stringify({ t: 'opened', id }));
 
-    if (useTLS) {
-      socket.on('secureConnect', onConnect);
-    } else {
-      socket.on('connect', onConnect);
-    }
+    // Set idle timeout
+    socket.setTimeout(this.config.rateLimits.idleTimeout, () => {
+      this.logger.info(userId, 'IDLE_TIMEOUT', { host, port });
+      socket.destroy();
+    });
 
     socket.on('data', (data) => {
       // SECURITY: Bandwidth limit check
       const bwCheck = this.rateLimiter.canTransfer(userId, data.length);
       if (!bwCheck.allowed) {
+        this.rejections.labels({ limit: bwCheck.limit }).inc();
         this.logger.info(userId, 'BANDWIDTH_EXCEEDED', { host, port });
         socket.destroy();
         return;
       }
 
       this.rateLimiter.recordBytes(userId, data.length);
-
-      const b64 = data.toString('base64');
-      ws.send(JSON.stringify({ t: 'data', id, b64 }));
+      this.bytesDownstream.inc(data.length);
+      this.sendData(ws, id, data, socket);
     });
 
     socket.on('close', () => {
-      clearTimeout(timeout);
       if (clientConnections.has(id)) {
         clientConnections.delete(id);
         this.rateLimiter.recordDisconnection(userId);
-        ws.send(JSON.stringify({ t: 'closed', id }));
+        this.sendLast(ws, id, { t: 'closed', id });
       }
     });
 
     socket.on('error', (err) => {
-      clearTimeout(timeout);
       this.logger.error(userId, 'SOCKET_ERROR', err);
       if (clientConnections.has(id)) {
         clientConnections.delete(id);
         this.rateLimiter.recordDisconnection(userId);
       }
-      ws.send(JSON.stringify({ t: 'error', id, msg: err.message }));
+      this.sendLast(ws, id, { t: 'error', id, msg: err.message });
     });
   }
 
+  setWeight(ws, id, weight) {
+    const scheduler = this.schedulers.get(ws);
+    if (scheduler) {
+      scheduler.setWeight(id, Math.min(Math.max(parseInt(weight, 10) || 1, 1), this.config.streams.maxWeight));
+    }
+  }
+
+  /**
+   * Queue data for the guest on a connection, in chunks the scheduler can interleave with other connections'. While
+   * too much is queued, source (what the data comes from) is paused.
+   *
+   * The chunks are views of data, not copies. On the WebSocket, each is a binary message of a 4-byte big-endian
+   * connection ID and then the chunk, sent as two fragments (see ResumableSocket.send()).
+   */
+  sendData(ws, id, data, source) {
+    const scheduler = this.schedulers.get(ws);
+    const { chunkSize, maxQueuedBytes } = this.config.streams;
+
+    for (let offset = 0; offset < data.length; offset += chunkSize) {
+      const chunk = data.subarray(offset, offset + chunkSize);
+      if (ws instanceof WebTransportSession) {
+        scheduler.push(id, chunk, chunk.length);  // On the connection's own stream
+      } else {
+        const header = Buffer.allocUnsafe(4);  // From Node's shared pool, as small buffers are
+        header.writeUInt32BE(id);
+        scheduler.push(id, [header, chunk], chunk.length);
+      }
+    }
+
+    if (scheduler.queued(id) > maxQueuedBytes) {
+      source.pause();
+      scheduler.whenBelow(id, maxQueuedBytes / 2, () => source.resume());
+    }
+  }
+
+  // A message that ends a connection, sent after the data queued for it
+  sendLast(ws, id, message) {
+    if (ws instanceof WebTransportSession) {
+      ws.finish(id, message);
+    } else {
+      this.schedulers.get(ws).push(id, JSON.stringify(message), 0, true);
+    }
+  }
+
   handleWrite(ws, userId, msg, clientConnections) {
-    const { id, b64 } = msg;
+    this.writeUpstream(ws, userId, msg.id, Buffer.from(msg.b64, 'base64'), clientConnections);
+  }
+
+  /**
+   * Write what the guest sent to a connection
+   * @returns {boolean} False if the socket's buffer is full, as for socket.write()
+   */
+  writeUpstream(ws, userId, id, data, clientConnections) {
     const conn = clientConnections.get(id);
 
     if (!conn) {
       ws.send(JSON.stringify({ t: 'error', id, msg: 'Connection not found' }));
-      return;
+      return true;
     }
 
-    const data = Buffer.from(b64, 'base64');
+    if (conn.http) {
+      ws.send(JSON.stringify({ t: 'error', id, msg: 'Cannot write to an HTTP request' }));
+      return true;
+    }
 
     // SECURITY: Bandwidth limit check
     const bwCheck = this.rateLimiter.canTransfer(userId, data.length);
     if (!bwCheck.allowed) {
+      this.rejections.labels({ limit: bwCheck.limit }).inc();
       this.logger.info(userId, 'BANDWIDTH_EXCEEDED', { id });
       ws.send(JSON.stringify({ t: 'error', id, msg: bwCheck.reason }));
-      return;
+      return true;
     }
 
     this.rateLimiter.recordBytes(userId, data.length);
-    conn.socket.write(data);
+    this.bytesUpstream.inc(data.length);
+    return conn.socket.write(data);
+  }
+
+  /**
+   * Make an HTTP request for the guest: {t: 'http', id, method, url, headers}
+   *
+   * Answers {t: 'response', id, status, headers} (after following redirects), then streams the body as binary frames
+   * (a 4-byte big-endian id, then data) with any Content-Encoding already undone, and ends with {t: 'closed', id}.
+   * Every hop gets the same port, DNS and IP checks as a TCP connection, and counts as one against the limits.
+   */
+  async handleHttp(ws, userId, msg, clientConnections) {
+    const { id } = msg;
+    const started = performance.now();
+    const method = (msg.method || 'GET').toUpperCase();
+
+    if (!this.config.http.methods.includes(method)) {
+      ws.send(JSON.stringify({ t: 'error', id, msg: `Method ${method} not allowed` }));
+      return;
+    }
+
+    let url;
+    try {
+      url = new URL(msg.url);
+    } catch (err) {
+      ws.send(JSON.stringify({ t: 'error', id, msg: 'Invalid URL' }));
+      return;
+    }
+
+    // What the guest may set. The rest (Host, Connection, framing, encoding) is up to the proxy.
+    const headers = {};
+    for (const [name, value] of Object.entries(msg.headers || {})) {
+      if (!/^(host|connection|keep-alive|proxy-.*|te|trailer|transfer-encoding|upgrade|content-length|accept-encoding)$/i
+        .test(name)) {
+        headers[name.toLowerCase()] = String(value);
+      }
+    }
+    headers['accept-encoding'] = 'gzip, deflate, br';
+
+    for (let redirects = 0; ; redirects++) {
+      const response = await this.httpRequest(ws, userId, id, method, url, headers);
+      if (!response) {
+        return;
+      }
+
+      const location = response.headers.location;
+      if ([301, 302, 303, 307, 308].includes(response.statusCode) && location &&
+          redirects < this.config.http.maxRedirects) {
+        response.resume();
+        this.rateLimiter.recordDisconnection(userId);
+        const next = new URL(location, url);
+        // SECURITY: The guest's credentials are for where it sent them, not wherever that redirects to
+        if (next.origin !== url.origin) {
+          delete headers.authorization;
+          delete headers.cookie;
+        }
+        url = next;
+        continue;
+      }
+
+      // The guest may have gone while this was in flight, and with it the cleanup of its connections
+      if (ws.readyState !== WebSocket.OPEN) {
+        response.destroy();
+        this.rateLimiter.recordDisconnection(userId);
+        return;
+      }
+
+      this.openHttp.observe((performance.now() - started) / 1000);
+      this.relayHttpResponse(ws, userId, id, msg.weight, url, response, clientConnections);
+      return;
+    }
+  }
+
+  /**
+   * One hop of handleHttp(): checks, then the request
+   * @returns {Promise<http.IncomingMessage|null>} Null once the guest has been sent the error
+   */
+  async httpRequest(ws, userId, id, method, url, headers) {
+    const useTLS = url.protocol === 'https:';
+    const port = parseInt(url.port, 10) || (useTLS ? 443 : 80);
+
+    // SECURITY: Validate scheme and port
+    if (!useTLS && url.protocol !== 'http:') {
+      ws.send(JSON.stringify({ t: 'error', id, msg: `Scheme ${url.protocol} not allowed` }));
+      return null;
+    }
+    if (!this.config.allowedPorts.includes(port)) {
+      this.logger.info(userId, 'BLOCKED_PORT', { host: url.hostname, port });
+      ws.send(JSON.stringify({ t: 'error', id, msg: `Port ${port} not allowed` }));
+      return null;
+    }
+
+    // SECURITY: Rate limit check, which holds a connection until the response is done
+    const rateCheck = await this.rateLimiter.reserveConnection(userId);
+    if (!rateCheck.allowed) {
+      this.rejections.labels({ limit: rateCheck.limit }).inc();
+      this.logger.info(userId, 'RATE_LIMITED', { host: url.hostname, port, reason: rateCheck.reason });
+      ws.send(JSON.stringify({ t: 'error', id, msg: rateCheck.reason }));
+      return null;
+    }
+
+    // SECURITY: DNS resolution with validation, the request goes to the address that was checked
+    let resolved;
+    try {
+      resolved = await this.dnsResolver.resolveAndValidate(url.hostname);
+    } catch (err) {
+      this.rateLimiter.recordDisconnection(userId);
+      this.logger.info(userId, 'DNS_BLOCKED', { host: url.hostname, port, error: err.message });
+      ws.send(JSON.stringify({ t: 'error', id, msg: err.message }));
+      return null;
+    }
+
+    return new Promise((resolve) => {
+      const request = (useTLS ? https : http).request({
+        // The connection is made here, racing the checked addresses, and TLS already set up on it
+        createConnection: (options, callback) => {
+          this.connector.connect(resolved.addresses, port, useTLS ? url.hostname : null)
+            .then((socket) => callback(null, socket), callback);
+        },
+        method,
+        path: url.pathname + url.search,
+        headers: { ...headers, host: url.host },
+        timeout: this.config.rateLimits.connectionTimeout,
+      });
+
+      request.on('response', resolve);
+      request.on('timeout', () => request.destroy(new Error('Connection timeout')));
+      request.on('error', (err) => {
+        this.logger.error(userId, 'HTTP_ERROR', err);
+        this.rateLimiter.recordDisconnection(userId);
+        ws.send(JSON.stringify({ t: 'error', id, msg: err.message }));
+        resolve(null);
+      });
+      request.end();
+
+      this.logger.info(userId, 'HTTP_REQUEST', { method, host: url.hostname, port, ip: resolved.ip, tls: useTLS });
+    });
+  }
+
+  relayHttpResponse(ws, userId, id, weight, url, response, clientConnections) {
+    const decoders = {
+      gzip: () => zlib.createGunzip(),
+      'x-gzip': () => zlib.createGunzip(),
+      deflate: () => zlib.createInflate(),
+      br: () => zlib.createBrotliDecompress(),
+    };
+    const encoding = (response.headers['content-encoding'] || '').trim().toLowerCase();
+    const body = decoders[encoding] ? response.pipe(decoders[encoding]()) : response;
+
+    const headers = { ...response.headers };
+    delete headers['connection'];
+    delete headers['transfer-encoding'];
+    if (decoders[encoding]) {
+      delete headers['content-encoding'];
+      delete headers['content-length'];
+    }
+
+    let closed = false;
+    const close = () => {
+      if (!closed) {
+        closed = true;
+        response.destroy();
+        body.destroy();
+      }
+    };
+    clientConnections.set(id, {
+      socket: { end: close, destroy: close },
+      host: url.hostname,
+      port: url.port,
+      http: true,
+    });
+
+    ws.send(JSON.stringify({ t: 'response', id, status: response.statusCode, headers }));
+
+    this.setWeight(ws, id, weight);
+
+    response.setTimeout(this.config.rateLimits.idleTimeout, () => {
+      this.logger.info(userId, 'IDLE_TIMEOUT', { host: url.hostname });
+      response.destroy(new Error('Idle timeout'));
+    });
+
+    body.on('data', (data) => {
+      // SECURITY: Bandwidth limit check
+      const bwCheck = this.rateLimiter.canTransfer(userId, data.length);
+      if (!bwCheck.allowed) {
+        this.rejections.labels({ limit: bwCheck.limit }).inc();
+        this.logger.info(userId, 'BANDWIDTH_EXCEEDED', { host: url.hostname });
+        body.destroy(new Error(bwCheck.reason));
+        return;
+      }
+
+      this.rateLimiter.recordBytes(userId, data.length);
+      this.bytesDownstream.inc(data.length);
+      this.sendData(ws, id, data, body);
+    });
+
+    const finish = (err) => {
+      if (!clientConnections.has(id) || clientConnections.get(id).socket.end !== close) {
+        return;
+      }
+      clientConnections.delete(id);
+      this.rateLimiter.recordDisconnection(userId);
+      this.sendLast(ws, id, err ? { t: 'error', id, msg: err.message } : { t: 'closed', id });
+    };
+    body.on('end', () => finish(null));
+    body.on('error', (err) => finish(err));
+    response.on('error', (err) => finish(err));
   }
 
   handleClose(ws, userId, msg, clientConnections) {
@@ -563,6 +2513,7 @@ class WSProxyServer {
 
     if (conn) {
       conn.socket.end();
+      this.schedulers.get(ws).drop(id);
       clientConnections.delete(id);
       this.rateLimiter.recordDisconnection(userId);
       this.logger.info(userId, 'CLOSED', { host: conn.host, port: conn.port });
@@ -571,15 +2522,178 @@ class WSProxyServer {
   }
 }
 
+// =============================================================================
+// Cluster - Sticky routing of WebSockets to worker processes
+// =============================================================================
+
+// Longest HTTP request head read before routing a connection
+const MAX_HEAD = 16 * 1024;
+
+/**
+ * Answer /metrics requests of workers, in the primary process: collect a snapshot from every worker and add the
+ * primary's own
+ */
+function serveClusterMetrics(metrics) {
+  const collecting = new Map();
+  let nextId = 1;
+
+  cluster.on('message', (worker, msg) => {
+    if (msg && msg.t === 'metrics') {
+      const id = nextId++;
+      const workers = Object.values(cluster.workers);
+      const snapshots = [metrics.snapshot()];
+
+      // A worker that does not answer in time is left out
+      const done = () => {
+        clearTimeout(timer);
+        collecting.delete(id);
+        if (worker.isConnected()) {
+          worker.send({ t: 'metrics', id: msg.id, snapshots });
+        }
+      };
+      const timer = setTimeout(done, 1000);
+
+      collecting.set(id, { snapshots, waiting: workers.length, done });
+      workers.forEach((w) => w.send({ t: 'metrics-collect', id }));
+    } else if (msg && msg.t === 'metrics-snapshot' && collecting.has(msg.id)) {
+      const collection = collecting.get(msg.id);
+      collection.snapshots.push(msg.snapshot);
+      if (--collection.waiting === 0) {
+        collection.done();
+      }
+    }
+  });
+}
+
+/**
+ * Which user a connection is for, as far as routing goes: the JWT if any, the client address otherwise. Routing only
+ * keeps a user's WebSockets together; limits do not depend on it.
+ */
+function routingKey(head, socket) {
+  const text = head.toString('latin1');
+  const requestLine = text.slice(0, text.indexOf('\r\n'));
+  const target = requestLine.split(' ')[1] || '/';
+
+  const token = new URL(target, 'http://localhost').searchParams.get('token');
+  if (token) {
+    return token;
+  }
+
+  const headers = {};
+  for (const line of text.split('\r\n').slice(1)) {
+    const colon = line.indexOf(':');
+    if (colon > 0) {
+      headers[line.slice(0, colon).trim().toLowerCase()] = line.slice(colon + 1).trim();
+    }
+  }
+
+  return headers['authorization'] || (headers['x-forwarded-for'] || '').split(',')[0].trim() || socket.remoteAddress;
+}
+
+// The worker that holds the session a WebSocket resumes, whose index starts the session token, if it resumes one
+function sessionWorker(head) {
+  const text = head.toString('latin1');
+  const target = text.slice(0, text.indexOf('\r\n')).split(' ')[1] || '/';
+  const match = /^(\d+)\./.exec(new URL(target, 'http://localhost').searchParams.get('session') || '');
+  return match ? parseInt(match[1], 10) : null;
+}
+
+function fnv1a(text) {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < text.length; i++) {
+    hash = Math.imul(hash ^ text.charCodeAt(i), 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+function startCluster(config) {
+  const workers = [];
+  const fork = (index) => {
+    workers[index] = cluster.fork({ WORKER_INDEX: String(index) });
+    workers[index].on('exit', (code, signal) => {
+      console.error(`Worker ${index} exited (${signal || code}), restarting`);
+      fork(index);
+    });
+  };
+  for (let i = 0; i < config.cluster.workers; i++) {
+    fork(i);
+  }
+
+  const rateLimiter = new RateLimiter(config.rateLimits);
+  serveClusterRateLimits(rateLimiter, config.cluster.leaseBytes);
+
+  const metrics = new Metrics();
+  metrics.registerProcess();
+  rateLimiter.registerMetrics(metrics);
+  serveClusterMetrics(metrics);
+
+  // A worker confirms it got a socket after Node has acknowledged the handle, so the primary's copy is closed by now.
+  cluster.on('message', (worker, msg) => {
+    if (msg && msg.t === 'sticky') {
+      worker.send({ t: 'sticky', id: msg.id });
+    }
+  });
+  let nextSocketId = 1;
+
+  // Read the request head to pick the worker, then hand the socket and what was read over.
+  const server = net.createServer((socket) => {
+    let head = Buffer.alloc(0);
+
+    const timeout = setTimeout(() => socket.destroy(), config.rateLimits.connectionTimeout);
+    const onData = (data) => {
+      head = Buffer.concat([head, data]);
+      if (head.indexOf('\r\n\r\n') < 0 && head.length < MAX_HEAD) {
+        return;
+      }
+
+      clearTimeout(timeout);
+      socket.removeListener('data', onData);
+      socket.pause();
+
+      const resumes = sessionWorker(head);
+      const worker = workers[resumes !== null && resumes < workers.length
+        ? resumes
+        : fnv1a(routingKey(head, socket)) % workers.length];
+      worker.send({ t: 'sticky', id: nextSocketId++, head: head.toString('base64') }, socket);
+    };
+
+    socket.on('data', onData);
+    socket.on('error', () => socket.destroy());
+  });
+
+  server.listen(config.port, () => {
+    console.log(`WebSocket proxy server listening on port ${config.port} with ${config.cluster.workers} workers`);
+    console.log(`Auth enabled: ${config.auth.enabled}`);
+    console.log(`Allowed ports: ${config.allowedPorts.join(', ')}`);
+  });
+
+  return server;
+}
+
 // =============================================================================
 // Entry Point
 // =============================================================================
 
-if (CONFIG.auth.enabled && CONFIG.auth.jwtSecret === 'dev-secret-change-in-production') {
-  console.warn('\n!!! WARNING !!!\n');
-  console.warn('Using default JWT secret. This is insecure for production.');
-  console.warn('Set JWT_SECRET environment variable to a secure random value.\n');
+// Run as a program; required as a module (bench/rate-limit-soak.js, bench/test-proxy.js), only the classes are wanted
+if (require.main === module) {
+  if (cluster.isPrimary && CONFIG.auth.enabled && CONFIG.auth.jwtSecret === 'dev-secret-change-in-production') {
+    console.warn('\n!!! WARNING !!!\n');
+    console.warn('Using default JWT secret. This is insecure for production.');
+    console.warn('Set JWT_SECRET environment variable to a secure random value.\n');
+  }
+
+  if (cluster.isPrimary && CONFIG.cluster.workers > 0) {
+    if (CONFIG.webTransport.port) {
+      console.warn('WEBTRANSPORT_PORT is ignored with CLUSTER_WORKERS, guests use the WebSocket');
+    }
+    startCluster(CONFIG);
+  } else {
+    const server = new WSProxyServer(CONFIG);
+    server.start();
+  }
 }
 
-const server = new WSProxyServer(CONFIG);
-server.start();
+module.exports = {
+  CONFIG, IPValidator, TimeWheel, RateLimiter, DNSResolver, Connector, StreamScheduler, WebTransportSession, Metrics,
+  WSProxyServer, startCluster,
+};
@@ -0,0 +1,139 @@
+// boot-snapshot.js - IndexedDB-backed snapshots of a booted root filesystem
+// SPDX-License-Identifier: MIT
+
+'use strict';
+
+/**
+ * BootSnapshot - Store the root filesystem as /init leaves it, to boot from it next time
+ *
+ * The state of running tasks cannot be saved: each task is a Worker with its call stack inside the Wasm engine, not in
+ * kernel memory. What can be saved is what /init spends its time on. After it has restored packages, it archives the
+ * root filesystem (uncompressed newc cpio) and hands it over, and the next boot uses that archive as its initrd. This
+ * skips fetching and unpacking the gzipped initramfs in the guest as well as restoring packages.
+ *
+ * A snapshot is only valid for the exact vmlinux and initrd it was made with, so it is keyed by their SHA-256 hashes.
+ * Only one snapshot is kept, saving a new one drops the rest.
+ *
+ * Usage:
+ *   const snapshots = new BootSnapshot();
+ *   await snapshots.init();
+ *
+ *   const key = await BootSnapshot.key(vmlinux_bytes, initrd_bytes);
+ *   const snapshot = await snapshots.load(key);  // { archive: ArrayBuffer, created: number } or null
+ *   await snapshots.save(key, archive);
+ */
+class BootSnapshot {
+  constructor(dbName = 'linux-wasm-snapshot') {
+    this.dbName = dbName;
+    this.db = null;
+    this.STORE_NAME = 'snapshots';
+  }
+
+  /**
+   * Hex encoded SHA-256 of a buffer
+   * @param {ArrayBuffer|Uint8Array} buffer
+   * @returns {Promise<string>}
+   */
+  static async hash(buffer) {
+    const digest = new Uint8Array(await crypto.subtle.digest('SHA-256', buffer));
+    return Array.from(digest, (byte) => byte.toString(16).padStart(2, '0')).join('');
+  }
+
+  /**
+   * Snapshot key for a vmlinux and initrd
+   * @param {ArrayBuffer} vmlinux - The vmlinux binary (not the compiled module)
+   * @param {ArrayBuffer} initrd - The initrd as fetched
+   * @returns {Promise<string>}
+   */
+  static async key(vmlinux, initrd) {
+    const [vmlinux_hash, initrd_hash] = await Promise.all([BootSnapshot.hash(vmlinux), BootSnapshot.hash(initrd)]);
+    return vmlinux_hash + ':' + initrd_hash;
+  }
+
+  /**
+   * Initialize the IndexedDB database
+   * @returns {Promise<void>}
+   */
+  async init() {
+    return new Promise((resolve, reject) => {
+      const request = indexedDB.open(this.dbName, 1);
+
+      request.onerror = () => {
+        reject(new Error('Failed to open IndexedDB: ' + request.error));
+      };
+
+      request.onsuccess = () => {
+        this.db = request.result;
+        resolve();
+      };
+
+      request.onupgradeneeded = (event) => {
+        const db = event.target.result;
+        if (!db.objectStoreNames.contains(this.STORE_NAME)) {
+          db.createObjectStore(this.STORE_NAME, { keyPath: 'key' });
+        }
+      };
+    });
+  }
+
+  /**
+   * Load the snapshot for a key
+   * @param {string} key - From BootSnapshot.key()
+   * @returns {Promise<{archive: ArrayBuffer, created: number}|null>} Null if there is none (or only a stale one)
+   */
+  async load(key) {
+    return new Promise((resolve, reject) => {
+      const tx = this.db.transaction([this.STORE_NAME], 'readonly');
+      const request = tx.objectStore(this.STORE_NAME).get(key);
+
+      request.onerror = () => reject(new Error('Failed to load snapshot: ' + request.error));
+      request.onsuccess = () => {
+        const record = request.result;
+        resolve(record ? { archive: record.archive, created: record.created } : null);
+      };
+    });
+  }
+
+  /**
+   * Save the snapshot for a key, replacing any other snapshot
+   * @param {string} key - From BootSnapshot.key()
+   * @param {ArrayBuffer} archive - Uncompressed newc cpio archive of the root filesystem
+   * @returns {Promise<void>}
+   */
+  async save(key, archive) {
+    return new Promise((resolve, reject) => {
+      const tx = this.db.transaction([this.STORE_NAME], 'readwrite');
+      const store = tx.objectStore(this.STORE_NAME);
+
+      store.clear();
+      store.put({
+        key: key,
+        archive: archive,
+        size: archive.byteLength,
+        created: Date.now(),
+      });
+
+      tx.onerror = () => reject(new Error('Failed to save snapshot: ' + tx.error));
+      tx.oncomplete = () => resolve();
+    });
+  }
+
+  /**
+   * Drop all snapshots (forcing a full boot next time)
+   * @returns {Promise<void>}
+   */
+  async clear() {
+    return new Promise((resolve, reject) => {
+      const tx = this.db.transaction([this.STORE_NAME], 'readwrite');
+      tx.objectStore(this.STORE_NAME).clear();
+
+      tx.onerror = () => reject(new Error('Failed to clear snapshots: ' + tx.error));
+      tx.oncomplete = () => resolve();
+    });
+  }
+}
+
+// Export for module systems
+if (typeof module !== 'undefined' && module.exports) {
+  module.exports = BootSnapshot;
+}
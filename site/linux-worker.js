@@ -23,6 +23,12 @@
   let user_executable = null;
   let user_executable_params = null;
 
+  /// Compiled module for the shared text of the user executable, handed to us by main together with a new task.
+  let user_module_preloaded = null;
+
+  /// Pending lookups in the compiled module cache of main, by text id.
+  const module_cache_requests = new Map();
+
   /// The user executabe instance, or null. Try using the instance variable in the promise over this one if possible.
   let user_executable_instance = null;
   let user_executable_imports = null;
@@ -33,8 +39,8 @@
   /// A messenger to synchronize with the main thread, as well as communicate how many bytes were read on the console.
   let console_read_messenger = new Int32Array(new SharedArrayBuffer(4));
 
-  /// A messenger for network operations. Format: [status, result/error]
-  let net_messenger = new Int32Array(new SharedArrayBuffer(8));
+  /// A messenger for network operations. Format: [status, result/error, HTTP status]
+  let net_messenger = new Int32Array(new SharedArrayBuffer(12));
 
   /// A messenger for filesystem operations. Format: [status, result/error]
   let fs_messenger = new Int32Array(new SharedArrayBuffer(8));
@@ -56,6 +62,165 @@
     });
   };
 
+  // ============================================================================
+  // Tracing - see options.trace in linux.js for the ring layout
+  // ============================================================================
+
+  /// Trace event kinds, stored with two arguments each. Keep in sync with TRACE_EVENTS in linux.js.
+  const TRACE_HOST_ENTER = 0;     // host call index
+  const TRACE_HOST_EXIT = 1;      // host call index
+  const TRACE_SYSCALL_ENTER = 2;  // syscall number
+  const TRACE_SYSCALL_EXIT = 3;   // syscall number, result
+  const TRACE_SWITCH = 4;         // prev task, next task
+  const TRACE_EXEC = 5;           // text id, memory pages
+  const TRACE_COMPILE_BEGIN = 6;  // text id, bytes
+  const TRACE_COMPILE_END = 7;    // text id
+  const TRACE_MEMORY_GROW = 8;    // Wasm pages, 0 for kernel memory or 1 for user memory
+
+  /// Our ring of the trace buffer, or null when not tracing (or no ring was free): { count: Int32Array, events: Float64Array, size }.
+  let trace_ring = null;
+
+  /// All rings, for summing them up in /proc/wasmstat: { buffer, rings, ring_bytes, ring_entries }.
+  let trace_layout = null;
+
+  /// Names of our host callbacks, indexed like the host call events.
+  let trace_host_calls = [];
+
+  /// Microseconds on the clock of wasm_cpu_clock_get_monotonic(), as a double.
+  const clock_us = () => 1000 * (performance.timeOrigin + performance.now());
+
+  const trace_event = (kind, a, b) => {
+    if (!trace_ring) {
+      return;
+    }
+
+    // We are the only writer of our ring. The count is published last, for readers in other threads.
+    const count = trace_ring.count[0];
+    const entry = (count % trace_ring.size) * 4;
+    trace_ring.events[entry] = clock_us();
+    trace_ring.events[entry + 1] = kind;
+    trace_ring.events[entry + 2] = a;
+    trace_ring.events[entry + 3] = b;
+    Atomics.store(trace_ring.count, 0, count + 1);
+  };
+
+  /// Sum up the events of all rings, for /proc/wasmstat.
+  const trace_summary = () => {
+    if (!trace_layout) {
+      return "tracing: off (load the page with ?trace=1)\n";
+    }
+
+    const host_calls = new Map();  // name -> { count, us }
+    const syscalls = new Map();  // nr -> { count, us }
+    const totals = { events: 0, rings: 0, switches: 0, execs: 0, compiles: 0, compile_us: 0, kernel_grows: 0,
+      kernel_pages: 0, user_grows: 0, user_pages: 0 };
+    const add = (map, key, us) => {
+      const entry = map.get(key) || { count: 0, us: 0 };
+      entry.count++;
+      entry.us += us;
+      map.set(key, entry);
+    };
+
+    for (let ring = 0; ring < trace_layout.rings; ring++) {
+      const offset = ring * trace_layout.ring_bytes;
+      const count = Atomics.load(new Int32Array(trace_layout.buffer, offset, 1), 0);
+      if (!count) {
+        continue;
+      }
+
+      const events = new Float64Array(trace_layout.buffer, offset + 32, trace_layout.ring_entries * 4);
+      const first = Math.max(0, count - trace_layout.ring_entries);
+      const open = [];  // Entered host calls and syscalls: [kind, arg, ts]
+      const compiling = new Map();  // text id -> ts, as compiles finish asynchronously
+      totals.rings++;
+      totals.events += count - first;
+
+      for (let i = first; i < count; i++) {
+        const entry = (i % trace_layout.ring_entries) * 4;
+        const ts = events[entry], kind = events[entry + 1], a = events[entry + 2], b = events[entry + 3];
+        switch (kind) {
+          case TRACE_HOST_ENTER:
+          case TRACE_SYSCALL_ENTER:
+            open.push([kind, a, ts]);
+            break;
+          case TRACE_HOST_EXIT:
+          case TRACE_SYSCALL_EXIT: {
+            // Exits without an entry were cut off by the ring wrapping around.
+            const entered = open.pop();
+            if (!entered || entered[1] !== a) {
+              break;
+            }
+            if (kind === TRACE_HOST_EXIT) {
+              add(host_calls, trace_host_calls[a] || ("host call " + a), ts - entered[2]);
+            } else {
+              add(syscalls, a, ts - entered[2]);
+            }
+            break;
+          }
+          case TRACE_COMPILE_BEGIN:
+            compiling.set(a, ts);
+            break;
+          case TRACE_COMPILE_END:
+            if (compiling.has(a)) {
+              totals.compiles++;
+              totals.compile_us += ts - compiling.get(a);
+              compiling.delete(a);
+            }
+            break;
+          case TRACE_SWITCH:
+            totals.switches++;
+            break;
+          case TRACE_EXEC:
+            totals.execs++;
+            break;
+          case TRACE_MEMORY_GROW:
+            totals[b ? "user_grows" : "kernel_grows"]++;
+            totals[b ? "user_pages" : "kernel_pages"] += a;
+            break;
+        }
+      }
+    }
+
+    const ms = (us) => (us / 1000).toFixed(3).padStart(12);
+    const top = (map, label) => Array.from(map.entries())
+      .sort((x, y) => y[1].us - x[1].us)
+      .slice(0, 16)
+      .map(([key, entry]) => "  " + label(key).padEnd(32) + String(entry.count).padStart(10) + ms(entry.us))
+      .join("\n");
+
+    return "tracing: on, " + totals.events + " events in " + totals.rings + " rings (" +
+        trace_layout.ring_entries + " kept per ring)\n" +
+      "task switches: " + totals.switches + "\n" +
+      "execs: " + totals.execs + "\n" +
+      "compiles: " + totals.compiles + ", " + (totals.compile_us / 1000).toFixed(3) + " ms\n" +
+      "kernel memory grows: " + totals.kernel_grows + ", " + totals.kernel_pages + " Wasm pages\n" +
+      "user memory grows: " + totals.user_grows + ", " + totals.user_pages + " Wasm pages\n" +
+      "\n" + "host calls".padEnd(34) + "count".padStart(10) + "ms".padStart(12) + "\n" +
+      top(host_calls, (name) => name) + "\n" +
+      "\n" + "syscalls".padEnd(34) + "count".padStart(10) + "ms".padStart(12) + "\n" +
+      top(syscalls, (nr) => "nr " + nr) + "\n";
+  };
+
+  /// Wrap a function to trace its calls as host calls (or syscalls, which take their number first).
+  const traced = (fn, index) => (...args) => {
+    trace_event(TRACE_HOST_ENTER, index, 0);
+    try {
+      return fn(...args);
+    } finally {
+      trace_event(TRACE_HOST_EXIT, index, 0);
+    }
+  };
+
+  const traced_syscall = (syscall) => (nr, ...args) => {
+    let result = 0;
+    trace_event(TRACE_SYSCALL_ENTER, nr, 0);
+    try {
+      return result = syscall(nr, ...args);
+    } finally {
+      trace_event(TRACE_SYSCALL_EXIT, nr, Number(result));
+    }
+  };
+
   /// Get a JS string object from a (nul-terminated) C-string in a Uint8Array.
   const get_cstring = (memory, index) => {
     const memory_u8 = new Uint8Array(memory.buffer);
@@ -318,8 +483,18 @@
       port.postMessage({ method: "stop_secondary", cpu: cpu });
     },
 
+    /// A milestone of the boot was reached, main keeps the time.
+    wasm_boot_phase: (phase) => {
+      // Indexed by WASM_BOOT_PHASE_* in asm/wasm.h.
+      const names = ["initramfs", "initramfs_done", "init"];
+      port.postMessage({ method: "boot_phase", phase: names[phase] || ("unknown " + phase) });
+    },
+
     /// Creation of tasks on our end. Runs them too.
-    wasm_create_and_run_task: (prev_task, new_task, name, bin_start, bin_end, data_start, table_start, clone_flags) => {
+    wasm_create_and_run_task: (prev_task, new_task, name, bin_start, bin_end, data_start, table_start, clone_flags,
+      text_id, memory_pages) => {
+      trace_event(TRACE_SWITCH, prev_task, new_task);
+
       // Tell main to create the new task, and then run it for the first time!
       port.postMessage({
         method: "create_and_run_task",
@@ -334,6 +509,8 @@
           bin_end: bin_end,
           data_start: data_start,
           table_start: table_start,
+          text_id: text_id,
+          memory_pages: memory_pages,
         } : null,
       });
 
@@ -351,6 +528,8 @@
 
     /// Serialization of tasks (idle tasks and before SMP is started).
     wasm_serialize_tasks: (prev_task, next_task) => {
+      trace_event(TRACE_SWITCH, prev_task, next_task);
+
       // Notify the next task that it can run again.
       port.postMessage({
         method: "serialize_tasks",
@@ -385,13 +564,25 @@
     },
 
     /// Replace the currently executing image (kthread spawning init, or user process) with a new user process image.
-    wasm_load_executable: (bin_start, bin_end, data_start, table_start) => {
-      user_executable = WebAssembly.compile(new Uint8Array(memory.buffer).slice(bin_start, bin_end));
+    wasm_load_executable: (bin_start, bin_end, data_start, table_start, text_id, memory_pages) => {
+      trace_event(TRACE_EXEC, text_id, memory_pages);
+      user_executable = load_user_module(bin_start, bin_end, text_id);
       user_executable_params = {
         data_start: data_start,
         table_start: table_start,
       };
 
+      // Make room for the data of the new executable up front, memory_pages is parsed from the binary by the kernel.
+      // Data goes at USER_DATA_BASE and the stack at 3/4 of user memory (see user_executable_setup()).
+      if (user_memory && memory_pages) {
+        const current_pages = user_memory.buffer.byteLength / 0x10000;
+        const needed_pages = Math.ceil((1 + memory_pages) * 4 / 3);
+        if (needed_pages > current_pages) {
+          user_memory.grow(needed_pages - current_pages);
+          trace_event(TRACE_MEMORY_GROW, needed_pages - current_pages, 1);
+        }
+      }
+
       // We release our reference already, just to be sure. The promise chain will still have a reference until the
       // kernel exits back to userland, which will termintate the user executable with a Trap.
       user_executable_instance = null;
@@ -448,7 +639,45 @@
     wasm_cpu_clock_get_monotonic: () => {
       // Convert this double in ms to u64 in us.
       // Modern browsers can on good days reach 5us accuracy, given that the platform supports it.
-      return BigInt(Math.round(1000 * (performance.timeOrigin + performance.now()))) * 1000n;
+      return BigInt(Math.round(clock_us())) * 1000n;
+    },
+
+    // Host callbacks used by tracing (arch/wasm/kernel/wasmstat.c).
+
+    wasm_trace_event: (event, arg) => {
+      // Indexed by WASM_TRACE_* in asm/wasm.h.
+      if (event == 0 /* WASM_TRACE_MEMORY_GROW */) {
+        trace_event(TRACE_MEMORY_GROW, arg, 0);
+      }
+    },
+
+    wasm_trace_summary: (buffer, size) => {
+      const encoded = text_encoder.encode(trace_summary()).slice(0, size);
+      new Uint8Array(memory.buffer).set(encoded, buffer);
+      return encoded.length;
+    },
+
+    // Host callbacks used by the Wasm memory balloon.
+
+    wasm_memory_discard: (start, size) => {
+      // The kernel will not touch this range until it takes it back. Wasm memory cannot shrink, but engines with the
+      // memory control proposal can decommit it. Otherwise, make sure it is zero, so that the host OS can compress or
+      // deduplicate it. Pages that are already zero are left alone, as writing would commit pages never touched.
+      if (typeof memory.discard === "function") {
+        memory.discard(start, size);
+        return;
+      }
+
+      const words = new Uint32Array(memory.buffer, start, size / 4);
+      const page_words = 0x1000 / 4;
+      for (let page = 0; page < words.length; page += page_words) {
+        for (let i = page; i < page + page_words; i++) {
+          if (words[i] !== 0) {
+            words.fill(0, page, page + page_words);
+            break;
+          }
+        }
+      }
     },
 
     // Host callbacks used by the Wasm-default console driver.
@@ -515,6 +744,34 @@
       }
     },
 
+    wasm_net_http: (method_ptr, url_ptr, headers_ptr, status_ptr) => {
+      // Reset messenger: [status, result, HTTP status]
+      Atomics.store(net_messenger, 0, -1);
+      Atomics.store(net_messenger, 1, 0);
+      Atomics.store(net_messenger, 2, 0);
+
+      // Request an HTTP request (made by the proxy) from main thread
+      port.postMessage({
+        method: "net_http",
+        // Not "method", that is the message type.
+        http_method: get_cstring(memory, method_ptr),
+        url: get_cstring(memory, url_ptr),
+        headers: get_cstring(memory, headers_ptr),
+        net_messenger: net_messenger,
+      });
+
+      // Wait for response
+      Atomics.wait(net_messenger, 0, -1);
+
+      if (Atomics.load(net_messenger, 0) !== 0) {
+        return -1;  // Error
+      }
+
+      // The HTTP status goes to the kernel, the connection ID is returned (its data is the response body).
+      new DataView(memory.buffer).setInt32(status_ptr, Atomics.load(net_messenger, 2), true);
+      return Atomics.load(net_messenger, 1);
+    },
+
     wasm_net_write: (connId, buffer, len) => {
       // Reset messenger
       Atomics.store(net_messenger, 0, -1);
@@ -797,12 +1054,118 @@
 
       return status === 0 ? bytesWritten : -1;
     },
+
+    // Boot snapshots (see boot-snapshot.js)
+
+    wasm_snapshot_save: (buffer, size, offset) => {
+      // Copy the chunk out of kernel memory and hand it over, main puts the archive together and stores it on its own
+      // time. An empty chunk ends the archive.
+      const chunk = new Uint8Array(memory.buffer).slice(buffer, buffer + size).buffer;
+      port.postMessage({
+        method: "snapshot_save",
+        chunk: chunk,
+        offset: offset,
+      }, [chunk]);
+      return 0;
+    },
+
+    // Lazily fetched initramfs layers (see build-initramfs in linux-wasm.sh)
+    // Messenger format: [status, size] where status 0 = success
+
+    wasm_layer_size: (hash_ptr) => {
+      // Fetch (and verify) the layer, return its size so that the caller can make room for it.
+      Atomics.store(fs_messenger, 0, -1);
+      Atomics.store(fs_messenger, 1, 0);
+
+      port.postMessage({
+        method: "layer_fetch",
+        hash: get_cstring(memory, hash_ptr),
+        layer_messenger: fs_messenger,
+      });
+
+      Atomics.wait(fs_messenger, 0, -1);
+
+      return Atomics.load(fs_messenger, 0) === 0 ? Atomics.load(fs_messenger, 1) : -1;
+    },
+
+    wasm_layer_read: (hash_ptr, buffer, size) => {
+      // Copy a layer fetched by wasm_layer_size() into buffer, return bytes written.
+      Atomics.store(fs_messenger, 0, -1);
+      Atomics.store(fs_messenger, 1, 0);
+
+      port.postMessage({
+        method: "layer_read",
+        hash: get_cstring(memory, hash_ptr),
+        buffer: buffer,
+        size: size,
+        layer_messenger: fs_messenger,
+      });
+
+      Atomics.wait(fs_messenger, 0, -1);
+
+      return Atomics.load(fs_messenger, 0) === 0 ? Atomics.load(fs_messenger, 1) : -1;
+    },
+  };
+
+  /// Ask main for a compiled module of a shared text, resolves to null if it has none.
+  const module_cache_get = (text_id) => new Promise((resolve) => {
+    module_cache_requests.set(text_id, resolve);
+    port.postMessage({
+      method: "module_cache_get",
+      text_id: text_id,
+    });
+  });
+
+  /// Get the compiled module of a user executable. The kernel keeps one copy of the text of each executable and gives
+  /// it an id (0 if it has none), which we use as a key in the module cache of main. Only on a miss do we copy the code
+  /// and compile it. The text stays alive for as long as our task runs the executable, so reading it later is fine.
+  const load_user_module = (bin_start, bin_end, text_id) => {
+    const compile = () => {
+      trace_event(TRACE_COMPILE_BEGIN, text_id, bin_end - bin_start);
+      return WebAssembly.compile(new Uint8Array(memory.buffer).slice(bin_start, bin_end)).finally(() => {
+        trace_event(TRACE_COMPILE_END, text_id, 0);
+      });
+    };
+
+    if (!text_id) {
+      return compile();
+    }
+
+    if (user_module_preloaded && user_module_preloaded.text_id === text_id) {
+      const module = user_module_preloaded.module;
+      user_module_preloaded = null;
+      return Promise.resolve(module);
+    }
+
+    return module_cache_get(text_id).then((module) => module || compile().then((module) => {
+      port.postMessage({
+        method: "module_cache_put",
+        text_id: text_id,
+        module: module,
+      });
+      return module;
+    }));
   };
 
   /// Callbacks from the main thread.
   const message_callbacks = {
     init: (message) => {
       runner_name = message.runner_name;
+
+      if (message.trace) {
+        trace_layout = message.trace;
+      }
+      if (message.trace && message.trace.ring !== null) {
+        const offset = message.trace.ring * message.trace.ring_bytes;
+        trace_ring = {
+          count: new Int32Array(message.trace.buffer, offset, 1),
+          events: new Float64Array(message.trace.buffer, offset + 32, message.trace.ring_entries * 4),
+          size: message.trace.ring_entries,
+        };
+
+        // Our ring may have been some dead runner's before.
+        Atomics.store(trace_ring.count, 0, 0);
+      }
       memory = message.memory;  // Kernel memory (shared)
       locks = message.locks;
       switch_to_last_task = message.last_task; // Only defined for tasks and CPU 0 (init task).
@@ -817,11 +1180,19 @@
 
       if (message.user_executable) {
         // We are in a new runner that should duplicate the user executable. Happens when someone calls clone().
+        if (message.user_executable.module) {
+          user_module_preloaded = {
+            text_id: message.user_executable.text_id,
+            module: message.user_executable.module,
+          };
+        }
         host_callbacks.wasm_load_executable(
           message.user_executable.bin_start,
           message.user_executable.bin_end,
           message.user_executable.data_start,
-          message.user_executable.table_start);
+          message.user_executable.table_start,
+          message.user_executable.text_id,
+          message.user_executable.memory_pages);
       }
 
       let import_object = {
@@ -831,6 +1202,15 @@
         },
       };
 
+      if (trace_ring) {
+        // The clock is read all the time by the idle loop, and is what we would time it with anyway.
+        trace_host_calls = Object.keys(host_callbacks).filter((name) => name != "wasm_cpu_clock_get_monotonic");
+        trace_host_calls.forEach((name, index) => {
+          import_object.env[name] = traced(host_callbacks[name], index);
+        });
+        port.postMessage({ method: "trace_host_calls", names: trace_host_calls });
+      }
+
       // We have to fixup unimplemented syscalls as they are declared but not defined by vmlinux (to avoid the
       // ni_syscall soup with unimplemented syscalls, which fails on Wasm due to a variable amount of arguments). Since
       // these syscalls should not really be called anyway, we can have a slow js stub deal with them, and it can handle
@@ -866,6 +1246,9 @@
         // An in-memory atomic flag ensures this only happens the first time vmlinux is instantiated on the main memory.
         return WebAssembly.instantiate(message.vmlinux, import_object).then((instance) => {
           vmlinux_instance = instance;
+          if (message.runner_type == "primary_cpu") {
+            port.postMessage({ method: "boot_phase", phase: "instantiated" });
+          }
         });
       };
 
@@ -887,7 +1270,9 @@
           //
           // All typed arrays and views on memory.buffer become invalid by growing and need to be re-created. grow()
           // will return the old size, which becomes our base address for initrd.
-          const initrd_start = memory.grow(((message.initrd.byteLength + 0xFFFF) / 0x10000) | 0) * 0x10000;
+          const initrd_pages = ((message.initrd.byteLength + 0xFFFF) / 0x10000) | 0;
+          const initrd_start = memory.grow(initrd_pages) * 0x10000;
+          trace_event(TRACE_MEMORY_GROW, initrd_pages, 0);
           const initrd_end = initrd_start + message.initrd.byteLength;
           new Uint8Array(memory.buffer).set(new Uint8Array(message.initrd), initrd_start);
           new DataView(memory.buffer).setUint32(vmlinux_instance.exports.initrd_start.value, initrd_start, true);
@@ -902,8 +1287,24 @@
           // _start() will never return, unless it fails to allocate all memoy it wants to.
           throw new Error("_start did not even succeed in allocating 16 pages of RAM, aborting...");
         } else if (message.runner_type == "secondary_cpu") {
+          let start_stack = message.start_stack;
+          if (start_stack === undefined) {
+            // We were spawned while CPU 0 boots. Park until __cpu_up() hands us our idle task in our slot, which it
+            // will do without calling out to main if it finds us parked (WASM_CPU_PARKED, see kernel/smp.c).
+            const slots = new Int32Array(memory.buffer);
+            const slot = vmlinux_instance.exports.wasm_secondary_idle_tasks.value / 4 + message.cpu;
+            Atomics.compareExchange(slots, slot, 0, 1 /* WASM_CPU_PARKED */);
+            Atomics.wait(slots, slot, 1);
+            const idle_task = Atomics.load(slots, slot) >>> 0;
+
+            // Let main know our idle task before we post anything that may have to switch back to it.
+            port.postMessage({ method: "secondary_started", cpu: message.cpu, idle_task: idle_task });
+
+            start_stack = idle_task & -16;  // Like __cpu_up() does.
+          }
+
           // start_secondary() will never return. It can be killed by terminate() on this Worker.
-          vmlinux_instance.exports._start_secondary(message.start_stack);
+          vmlinux_instance.exports._start_secondary(start_stack);
 
           throw new Error("start_secondary returned");
         } else if (message.runner_type == "task") {
@@ -928,6 +1329,10 @@
         const kernel_stack_pointer = vmlinux_instance.exports.get_user_stack_pointer();
         const kernel_tls_base = vmlinux_instance.exports.get_user_tls_base();
 
+        // Both stay valid for the life of the user instance, as user tasks are pinned to their CPU.
+        const vdso_data = vmlinux_instance.exports.wasm_vdso_data.value;
+        const vdso_task = vmlinux_instance.exports.wasm_vdso_task_slot();
+
         // Memory isolation configuration
         // DISABLED: The kernel's argv/envp setup creates pointers to kernel memory.
         // When we copy stack to user memory, those pointers still point to kernel
@@ -1451,12 +1856,32 @@
             __wasm_syscall_5: make_syscall_wrapper(vmlinux_instance.exports.wasm_syscall_5, 5),
             __wasm_syscall_6: make_syscall_wrapper(vmlinux_instance.exports.wasm_syscall_6, 6),
 
+            // vDSO: libc reads the kernel timekeeping data and task identity directly, see asm/vdso.h in the kernel.
+            // The clock must be exactly the one backing the kernel clocksource, or time could go backwards. With
+            // memory isolation, kernel memory is not reachable by user code, so we return NULL to make libc fall back
+            // to the syscalls.
+            __wasm_vdso_clock: host_callbacks.wasm_cpu_clock_get_monotonic,
+            __wasm_vdso_data: () => use_memory_isolation ? 0 : vdso_data,
+            __wasm_vdso_task: () => use_memory_isolation ? 0 : vdso_task,
+
             __wasm_abort: () => {
               debugger
               throw WebAssembly.RuntimeError('abort');
             },
           },
 
+          // Host services for helper programs like pkghelper. They take pointers into kernel memory, so they are not
+          // available with memory isolation.
+          wasi_snapshot_preview1: use_memory_isolation ? {} : {
+            wasm_pkg_check: host_callbacks.wasm_pkg_check,
+            wasm_pkg_install: host_callbacks.wasm_pkg_install,
+            wasm_pkg_restore: host_callbacks.wasm_pkg_restore,
+            wasm_pkg_list_cached: host_callbacks.wasm_pkg_list_cached,
+            wasm_snapshot_save: host_callbacks.wasm_snapshot_save,
+            wasm_layer_size: host_callbacks.wasm_layer_size,
+            wasm_layer_read: host_callbacks.wasm_layer_read,
+          },
+
           // GOT (Global Offset Table) modules for dynamic linking
           // These provide relocated addresses for global variables and functions
           "GOT.mem": new Proxy({}, {
@@ -1500,6 +1925,14 @@
           }),
         };
 
+        // Tracing syscalls costs a JavaScript wrapper on each of them, so only do it when asked to.
+        if (trace_ring) {
+          for (let i = 0; i <= 6; i++) {
+            user_executable_imports.env["__wasm_syscall_" + i] =
+              traced_syscall(user_executable_imports.env["__wasm_syscall_" + i]);
+          }
+        }
+
         // Instantiate a user Wasm Module. This will implicitly run __wasm_init_memory, which will effectively:
         // * Initialize the TLS pointer (to a data_start-relocated static area, for the first thread).
         // * Copy all passive data segments into their (data_start-relocated) position.
@@ -1592,6 +2025,12 @@
       // and exex() can trap us, in which case we have to circle back to loading new user code and executing it agian.
       vmlinux_setup().then(vmlinux_run).catch(wasm_error).then(user_executable_chain);
     },
+
+    module_cache_reply: (message) => {
+      const resolve = module_cache_requests.get(message.text_id);
+      module_cache_requests.delete(message.text_id);
+      resolve(message.module);
+    },
   };
 
   self.onmessage = (message_event) => {
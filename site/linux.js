@@ -1,7 +1,14 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 /// Create a Linux machine and run it.
-const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_write) => {
+///
+/// options.on_snapshot(archive) is called when /init hands over a snapshot of the root filesystem, see boot-snapshot.js.
+/// options.layer_url is where lazily fetched initramfs layers are found (default "layers/"), see linux-wasm.sh.
+/// options.on_boot_phase(phase, ms) is called as the boot reaches "instantiated" (vmlinux on CPU 0), "initramfs",
+/// "initramfs_done" and "init" (/init execs), with the time since linux() was called.
+/// options.trace turns on tracing of host calls, syscalls, task switches, execs, compiles and memory grows. Export it
+/// with trace_export() in the returned object, the guest sums it up in /proc/wasmstat.
+const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_write, options = {}) => {
   /// Dict of online CPUs.
   const cpus = {};
 
@@ -18,6 +25,35 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
   let netProxy = null;
   const netConnections = new Map();  // connId -> { buffer, closed, error }
 
+  // Buffer what arrives on a proxy connection until the guest reads it.
+  const net_track = (connId) => {
+    netConnections.set(connId, {
+      buffer: new Uint8Array(0),
+      closed: false,
+      error: null,
+    });
+
+    netProxy.onData(connId, (data) => {
+      const conn = netConnections.get(connId);
+      if (conn) {
+        const newBuffer = new Uint8Array(conn.buffer.length + data.length);
+        newBuffer.set(conn.buffer);
+        newBuffer.set(data, conn.buffer.length);
+        conn.buffer = newBuffer;
+      }
+    });
+
+    netProxy.onClose(connId, () => {
+      const conn = netConnections.get(connId);
+      if (conn) conn.closed = true;
+    });
+
+    netProxy.onError(connId, (err) => {
+      const conn = netConnections.get(connId);
+      if (conn) conn.error = err.message;
+    });
+  };
+
   // Filesystem persistence support
   let fsPersist = null;
 
@@ -31,6 +67,59 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
   const syscall_buffers = new Map();  // task_ptr -> buffer_offset
   let next_syscall_buffer_offset = 0;  // Will be set after memory is created
 
+  // Compiled user executables, shared by all tasks. Keyed by the text id of the kernel, which is unique for each copy of
+  // an executable, so entries never go stale - old ones just fall out of this LRU (Map iterates in insertion order).
+  const COMPILED_MODULE_CACHE_SIZE = 32;
+  const compiled_modules = new Map();  // text_id -> WebAssembly.Module
+
+  // Initramfs layers fetched for the guest, kept until every process that fetched one has read it (several may run
+  // the same stub for the first time at once). Named by the SHA-256 of their contents.
+  const layers = new Map();  // hash -> { content: Promise<ArrayBuffer>, buffer: ArrayBuffer once fetched, readers }
+
+  // Chunks of the boot snapshot /init is handing over, in order (see wasm_snapshot_save in linux-worker.js).
+  let snapshot_chunks = [];
+  let snapshot_size = 0;
+
+  const sha256_hex = async (buffer) => {
+    const digest = new Uint8Array(await crypto.subtle.digest("SHA-256", buffer));
+    return Array.from(digest, (byte) => byte.toString(16).padStart(2, "0")).join("");
+  };
+
+  const fetch_layer = async (hash) => {
+    const response = await fetch((options.layer_url || "layers/") + hash);
+    if (!response.ok) {
+      throw new Error("HTTP " + response.status);
+    }
+
+    // Content addressing makes layers immutable (cacheable forever), and lets us check what we got.
+    const content = await response.arrayBuffer();
+    if (await sha256_hex(content) !== hash) {
+      throw new Error("content does not match its hash");
+    }
+
+    log(`[Layer] Fetched ${hash} (${content.byteLength} bytes)`);
+    return content;
+  };
+
+  /// Trace buffer, or null when not tracing. Each runner writes events into its own ring, taken from a free list in
+  /// the order they were given back so that rings of dead runners live on for a while. Runners made while every ring is
+  /// taken are not traced. A ring is a 32 byte header (an Int32 count of events ever written) and
+  /// ring_entries events of 4 doubles: [timestamp in us, kind, arg, arg]. Kinds are listed in TRACE_EVENTS.
+  const TRACE_RINGS = 128;
+  const TRACE_RING_ENTRIES = 2048;
+  const trace = options.trace ? {
+    buffer: new SharedArrayBuffer(TRACE_RINGS * (32 + TRACE_RING_ENTRIES * 32)),
+    rings: TRACE_RINGS,
+    ring_bytes: 32 + TRACE_RING_ENTRIES * 32,
+    ring_entries: TRACE_RING_ENTRIES,
+  } : null;
+  const trace_ring_names = [];
+  let trace_host_calls = [];
+  const free_trace_rings = Array.from({ length: TRACE_RINGS }, (_, ring) => ring);
+
+  /// When the boot started, for timing its phases.
+  const boot_start = performance.now();
+
   const lock_notify = (locks, lock, count) => {
     Atomics.store(locks._memory, locks[lock], 1);
     Atomics.notify(locks._memory, locks[lock], count || 1);
@@ -55,11 +144,33 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
         throw new Error("Trying to start secondary cpu with ID <= 0");
       }
 
+      if (cpus[message.cpu]) {
+        // Spawned while CPU 0 booted, it finds its idle task in kernel memory and starts by itself.
+        return;
+      }
+
       log("Starting cpu " + message.cpu + " (" + message.idle_task + ")" +
         " with start stack " + message.start_stack);
       make_cpu(message.cpu, message.idle_task, message.start_stack);
     },
 
+    secondary_started: (message) => {
+      log("Started parked cpu " + message.cpu + " (" + message.idle_task + ")");
+      tasks[message.idle_task] = cpus[message.cpu];
+    },
+
+    trace_host_calls: (message) => {
+      trace_host_calls = message.names;
+    },
+
+    boot_phase: (message) => {
+      const ms = performance.now() - boot_start;
+      log("[Boot] " + message.phase + " after " + ms.toFixed(0) + " ms");
+      if (options.on_boot_phase) {
+        options.on_boot_phase(message.phase, ms);
+      }
+    },
+
     stop_secondary: (message) => {
       if (message.cpu <= 0) {
         // If you arrive here, you probably got panic():ed with a broken stack.
@@ -73,6 +184,7 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
       if (cpus[message.cpu]) {
         log("[Main]: Stopping CPU " + message.cpu);
         cpus[message.cpu].worker.terminate();
+        free_trace_ring(cpus[message.cpu]);
         delete cpus[message.cpu];
       } else {
         log("[Main]: Tried to stop CPU " + message.cpu + " but it was already stopped (broken system)!");
@@ -84,10 +196,101 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
       make_task(message.prev_task, message.new_task, message.name, message.user_executable, message.clone_flags);
     },
 
+    // Initramfs layer callbacks
+    layer_fetch: async (message, worker) => {
+      let layer = layers.get(message.hash);
+      if (!layer) {
+        layer = { content: fetch_layer(message.hash), buffer: null, readers: 0 };
+        layers.set(message.hash, layer);
+      }
+      layer.readers++;
+
+      try {
+        layer.buffer = await layer.content;
+        Atomics.store(message.layer_messenger, 1, layer.buffer.byteLength);
+        Atomics.store(message.layer_messenger, 0, 0);  // success
+      } catch (err) {
+        log(`[Layer] Failed to fetch ${message.hash}: ${err.message}`);
+        if (layers.get(message.hash) === layer) {
+          layers.delete(message.hash);  // Try again next time.
+        }
+        Atomics.store(message.layer_messenger, 0, 1);  // error
+      }
+      Atomics.notify(message.layer_messenger, 0, 1);
+    },
+
+    layer_read: (message, worker) => {
+      const layer = layers.get(message.hash);
+      const content = layer && layer.buffer;
+      if (content && content.byteLength <= message.size) {
+        new Uint8Array(memory.buffer).set(new Uint8Array(content), message.buffer);
+        if (--layer.readers === 0) {
+          layers.delete(message.hash);  // Every process that fetched it has its own copy now.
+        }
+        Atomics.store(message.layer_messenger, 1, content.byteLength);
+        Atomics.store(message.layer_messenger, 0, 0);  // success
+      } else {
+        Atomics.store(message.layer_messenger, 0, 1);  // error
+      }
+      Atomics.notify(message.layer_messenger, 0, 1);
+    },
+
+    snapshot_save: (message) => {
+      if (message.offset === 0) {
+        snapshot_chunks = [];
+        snapshot_size = 0;
+      }
+      if (message.offset !== snapshot_size) {
+        return;  // Lost the start of this archive, wait for the next one.
+      }
+      if (message.chunk.byteLength) {
+        snapshot_chunks.push(new Uint8Array(message.chunk));
+        snapshot_size += message.chunk.byteLength;
+        return;
+      }
+
+      const archive = new Uint8Array(snapshot_size);
+      let offset = 0;
+      for (const chunk of snapshot_chunks) {
+        archive.set(chunk, offset);
+        offset += chunk.byteLength;
+      }
+      snapshot_chunks = [];
+      snapshot_size = 0;
+
+      if (options.on_snapshot) {
+        log("[Snapshot] Got a root filesystem snapshot of " + archive.byteLength + " bytes");
+        options.on_snapshot(archive.buffer);
+      }
+    },
+
+    module_cache_get: (message, worker) => {
+      const module = compiled_modules.get(message.text_id) || null;
+      if (module) {
+        // Mark as most recently used.
+        compiled_modules.delete(message.text_id);
+        compiled_modules.set(message.text_id, module);
+      }
+
+      worker.postMessage({
+        method: "module_cache_reply",
+        text_id: message.text_id,
+        module: module,
+      });
+    },
+
+    module_cache_put: (message) => {
+      compiled_modules.set(message.text_id, message.module);
+      while (compiled_modules.size > COMPILED_MODULE_CACHE_SIZE) {
+        compiled_modules.delete(compiled_modules.keys().next().value);
+      }
+    },
+
     release_task: (message) => {
       // Stop the worker, which will stop script execution. This is safe as the task should be hanging on a lock waiting
       // to be scheduled - which never happens as dead tasks don't get ever get scheduled.
       tasks[message.dead_task].worker.terminate();
+      free_trace_ring(tasks[message.dead_task]);
 
       // Free isolated user memory for this task
       free_task_memory(message.dead_task);
@@ -139,39 +342,49 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
 
       try {
         const connId = await netProxy.open(message.host, message.port);
+        net_track(connId);
 
-        netConnections.set(connId, {
-          buffer: new Uint8Array(0),
-          closed: false,
-          error: null,
-        });
+        Atomics.store(message.net_messenger, 0, 0);  // success
+        Atomics.store(message.net_messenger, 1, connId);
+        Atomics.notify(message.net_messenger, 0, 1);
 
-        netProxy.onData(connId, (data) => {
-          const conn = netConnections.get(connId);
-          if (conn) {
-            const newBuffer = new Uint8Array(conn.buffer.length + data.length);
-            newBuffer.set(conn.buffer);
-            newBuffer.set(data, conn.buffer.length);
-            conn.buffer = newBuffer;
-          }
-        });
+      } catch (err) {
+        log('[Net] Open failed: ' + err.message);
+        Atomics.store(message.net_messenger, 0, 1);  // error
+        Atomics.store(message.net_messenger, 1, -1);
+        Atomics.notify(message.net_messenger, 0, 1);
+      }
+    },
 
-        netProxy.onClose(connId, () => {
-          const conn = netConnections.get(connId);
-          if (conn) conn.closed = true;
-        });
+    net_http: async (message, worker) => {
+      // Like net_open, but the proxy makes an HTTP request and the connection carries the response body.
+      if (!netProxy) {
+        Atomics.store(message.net_messenger, 0, 1);
+        Atomics.store(message.net_messenger, 1, -1);
+        Atomics.notify(message.net_messenger, 0, 1);
+        return;
+      }
 
-        netProxy.onError(connId, (err) => {
-          const conn = netConnections.get(connId);
-          if (conn) conn.error = err.message;
-        });
+      try {
+        // "Name: value" lines, as the guest passes them.
+        const headers = {};
+        for (const line of message.headers.split('\n')) {
+          const colon = line.indexOf(':');
+          if (colon > 0) {
+            headers[line.slice(0, colon).trim()] = line.slice(colon + 1).trim();
+          }
+        }
 
+        const response = await netProxy.http(message.http_method, message.url, headers);
+        net_track(response.id);
+
+        Atomics.store(message.net_messenger, 2, response.status);
+        Atomics.store(message.net_messenger, 1, response.id);
         Atomics.store(message.net_messenger, 0, 0);  // success
-        Atomics.store(message.net_messenger, 1, connId);
         Atomics.notify(message.net_messenger, 0, 1);
 
       } catch (err) {
-        log('[Net] Open failed: ' + err.message);
+        log('[Net] HTTP request failed: ' + err.message);
         Atomics.store(message.net_messenger, 0, 1);  // error
         Atomics.store(message.net_messenger, 1, -1);
         Atomics.notify(message.net_messenger, 0, 1);
@@ -498,6 +711,69 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
     },
   };
 
+  /// Names of trace event kinds, indexed by kind (see TRACE_* in linux-worker.js).
+  const TRACE_EVENTS = ["host_enter", "host_exit", "syscall_enter", "syscall_exit", "switch", "exec", "compile_begin",
+    "compile_end", "memory_grow"];
+
+  /// Convert the trace buffer to the Chrome trace event format, with one thread per ring.
+  const trace_events = () => {
+    const events = [];
+    const hex = (value) => "0x" + (value >>> 0).toString(16);
+
+    for (let ring = 0; ring < trace.rings; ring++) {
+      const offset = ring * trace.ring_bytes;
+      const count = Atomics.load(new Int32Array(trace.buffer, offset, 1), 0);
+      if (!count) {
+        continue;
+      }
+
+      events.push({ name: "thread_name", ph: "M", pid: 1, tid: ring, args: { name: trace_ring_names[ring] } });
+
+      const ring_events = new Float64Array(trace.buffer, offset + 32, trace.ring_entries * 4);
+      for (let i = Math.max(0, count - trace.ring_entries); i < count; i++) {
+        const entry = (i % trace.ring_entries) * 4;
+        const ts = ring_events[entry], a = ring_events[entry + 2], b = ring_events[entry + 3];
+        const kind = TRACE_EVENTS[ring_events[entry + 1]];
+        const event = { pid: 1, tid: ring, ts: ts };
+
+        switch (kind) {
+          case "host_enter":
+          case "host_exit":
+            event.name = trace_host_calls[a] || ("host call " + a);
+            event.ph = kind == "host_enter" ? "B" : "E";
+            break;
+          case "syscall_enter":
+            Object.assign(event, { name: "syscall " + a, ph: "B" });
+            break;
+          case "syscall_exit":
+            Object.assign(event, { name: "syscall " + a, ph: "E", args: { result: b } });
+            break;
+          case "switch":
+            Object.assign(event, { name: "switch", ph: "i", args: { prev: hex(a), next: hex(b) } });
+            break;
+          case "exec":
+            Object.assign(event, { name: "exec", ph: "i", args: { text_id: a, memory_pages: b } });
+            break;
+          case "compile_begin":
+            // Compiles are asynchronous and may overlap with anything else on the thread.
+            Object.assign(event, { name: "compile", cat: "compile", ph: "b", id: a, args: { bytes: b } });
+            break;
+          case "compile_end":
+            Object.assign(event, { name: "compile", cat: "compile", ph: "e", id: a });
+            break;
+          case "memory_grow":
+            Object.assign(event, { name: b ? "grow user memory" : "grow kernel memory", ph: "i", args: { pages: a } });
+            break;
+          default:
+            continue;
+        }
+        events.push(event);
+      }
+    }
+
+    return { traceEvents: events, displayTimeUnit: "ms" };
+  };
+
   /// Memory shared between all CPUs (kernel memory).
   const memory = new WebAssembly.Memory({
     initial: 30, // TODO: extract this automatically from vmlinux.
@@ -507,6 +783,7 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
 
   // Reserve space for syscall buffers after initial kernel memory
   // We'll allocate from a high address to avoid conflicts with kernel data
+  // NOTE: The kernel grows its memory on demand up to CONFIG_WASM_MEMORY_MAX_MB, which must stay below this.
   const SYSCALL_BUFFER_BASE = 0x70000000;  // 1.75 GB mark
   next_syscall_buffer_offset = SYSCALL_BUFFER_BASE;
 
@@ -539,6 +816,16 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
     return user_mem;
   };
 
+  /**
+   * Size of user memory for a new process.
+   * @param {number} memory_pages - Linear memory the executable needs, as parsed from the binary by the kernel
+   * @returns {number} Initial memory size in 64KB pages (at least the default 256 = 16MB)
+   */
+  const user_memory_pages = (memory_pages = 0) => {
+    // The runner puts data at 64KB and the stack at 3/4 of user memory, the data has to fit in between.
+    return Math.max(256, Math.ceil((1 + memory_pages) * 4 / 3));
+  };
+
   /**
    * Allocate a syscall buffer for a task in kernel memory.
    * @param {number} task_ptr - The task pointer
@@ -617,11 +904,14 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
    * This will run boot code for the CPU, and then drop to run the idle task. For CPU 0 this involves booting the entire
    * system, including bringing up secondary CPUs at the end, while for secondary CPUs, this just means some
    * book-keeping before dropping into their own idle tasks.
+   *
+   * A secondary CPU created without an idle task is parked until the kernel brings it up (see the runner).
    */
   const make_cpu = (cpu, idle_task, start_stack) => {
     const options = {
       runner_type: (cpu == 0) ? "primary_cpu" : "secondary_cpu",
-      start_stack: start_stack,  // undefined for CPU 0
+      cpu: cpu,
+      start_stack: start_stack,  // undefined for CPU 0 and parked CPUs
     };
 
     if (cpu == 0) {
@@ -630,13 +920,14 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
       initrd = null;  // allow gc
     }
 
-    // idle_task is undefined for cpu 0, we will know it first when start_primary notifies us.
-    const name = "CPU " + cpu + " [boot+idle]" + (cpu != 0 ? " (" + idle_task + ")" : "");
+    // idle_task is undefined for cpu 0, we will know it first when start_primary notifies us. Same for parked CPUs and
+    // secondary_started.
+    const name = "CPU " + cpu + " [boot+idle]" + (idle_task !== undefined ? " (" + idle_task + ")" : "");
 
     const runner = make_vmlinux_runner(name, options);
     cpus[cpu] = runner;
-    if (cpu != 0) {
-      tasks[idle_task] = runner; // For CPU 0, start_primary does this registration for us.
+    if (idle_task !== undefined) {
+      tasks[idle_task] = runner;
     }
   };
 
@@ -690,11 +981,17 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
         }
       } else {
         // New process (exec from kthread): Create fresh memory with default size
-        user_memory = create_user_memory(new_task);  // Uses default 256 pages = 16MB
+        user_memory = create_user_memory(new_task, user_memory_pages(user_executable.memory_pages));
       }
 
       // Allocate syscall buffer in kernel memory
       syscall_buffer_offset = allocate_syscall_buffer(new_task);
+
+      // Hand over an already compiled module, saving the new runner a round trip (or a compile).
+      const module = compiled_modules.get(user_executable.text_id);
+      if (module) {
+        user_executable = { ...user_executable, module: module };
+      }
     }
 
     const options = {
@@ -739,9 +1036,18 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
       throw error;
     };
 
+    let trace_ring = undefined;
+    if (trace) {
+      trace_ring = { ...trace, ring: free_trace_rings.length ? free_trace_rings.shift() : null };
+      if (trace_ring.ring !== null) {
+        trace_ring_names[trace_ring.ring] = name;
+      }
+    }
+
     worker.postMessage({
       ...options,
       method: "init",
+      trace: trace_ring,
       vmlinux: vmlinux,
       memory: memory,  // Kernel memory (shared)
       locks: locks,
@@ -754,12 +1060,28 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
       worker: worker,
       locks: locks,
       last_task: last_task,
+      trace_ring: trace_ring ? trace_ring.ring : null,
     };
   };
 
+  /// Give a stopped runner's trace ring back, its events stay until another runner takes it.
+  const free_trace_ring = (runner) => {
+    if (runner.trace_ring !== null) {
+      free_trace_rings.push(runner.trace_ring);
+      runner.trace_ring = null;
+    }
+  };
+
   // Create the primary cpu, it will later on callback to us and we start secondaries.
   make_cpu(0);
 
+  // Spawn the secondaries the kernel will bring up right away, so that their Workers start and instantiate vmlinux
+  // while CPU 0 boots, instead of one after the other when it gets there.
+  const maxcpus = /(?:^| )maxcpus=(\d+)/.exec(boot_cmdline);
+  for (let cpu = 1; maxcpus && cpu < parseInt(maxcpus[1], 10); cpu++) {
+    make_cpu(cpu);
+  }
+
   return {
     key_input: (data) => {
       const key_buffer = text_encoder.encode(data);  // Possibly UTF-8 (up to 16 bits).
@@ -799,6 +1121,36 @@ const linux = async (worker_url, vmlinux, boot_cmdline, initrd, log, console_wri
     },
 
     // Get filesystem persistence instance for direct access
-    getFsPersist: () => fsPersist
+    getFsPersist: () => fsPersist,
+
+    // Get the trace as Chrome trace events (load it in chrome://tracing or Perfetto), null when not tracing
+    trace_export: () => trace ? trace_events() : null,
   };
 };
+
+/// Create a Linux machine from a boot snapshot (see boot-snapshot.js) and run it.
+///
+/// The snapshot archive replaces the initrd, and /init recognizes it and skips the work that went into it. Checking that
+/// the snapshot belongs to vmlinux is up to the caller (BootSnapshot.key()).
+const linux_resume = async (worker_url, vmlinux, boot_cmdline, snapshot, log, console_write, options = {}) => {
+  log("Resuming from boot snapshot of " + new Date(snapshot.created).toISOString());
+  return linux(worker_url, vmlinux, boot_cmdline, snapshot.archive, log, console_write, options);
+};
+
+/// Fetch a gzipped initramfs, decompressing it while it downloads.
+///
+/// The kernel takes an uncompressed cpio archive as well, and unpacking it there saves running gunzip as interpreted
+/// Wasm during boot. Falls back to handing over the compressed archive when DecompressionStream is missing. If the
+/// server sent it with a Content-Encoding, the browser has already decompressed it for us.
+const linux_fetch_initrd = async (url) => {
+  const response = await fetch(url);
+  if (!response.ok) {
+    throw new Error("Failed to fetch initrd: " + response.status);
+  }
+
+  if (typeof DecompressionStream === "undefined" || response.headers.get("Content-Encoding")) {
+    return response.arrayBuffer();
+  }
+
+  return new Response(response.body.pipeThrough(new DecompressionStream("gzip"))).arrayBuffer();
+};
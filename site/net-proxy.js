@@ -3,6 +3,145 @@
 
 'use strict';
 
+/**
+ * StreamScheduler - Weighted round robin over per-connection send queues: deficit round robin, with a list for new
+ * streams as in FQ-CoDel.
+ *
+ * Frames go to the WebSocket only while it has less than highWater bytes queued. The rest wait in their connection's
+ * queue. Each turn, a connection may send chunkSize * weight bytes. A connection that had nothing queued goes ahead
+ * of the busy ones for its first turn, so an interactive session's keystrokes do not wait behind an upload's backlog.
+ * Frames that cost 0 bytes (control messages) take no share, but keep their place in the order.
+ *
+ * Same as the one in server/ws-proxy.js, which schedules the other direction.
+ */
+class StreamScheduler {
+  constructor(options) {
+    this.chunkSize = options.chunkSize;
+    this.highWater = options.highWater;
+    this.send = options.send;                      // (frame) => void
+    this.bufferedAmount = options.bufferedAmount;  // () => bytes queued on the WebSocket
+    this.held = options.held;                      // () => void, when frames are left waiting
+    this.streams = new Map();
+    this.newStreams = [];
+    this.oldStreams = [];
+    this.stopped = false;
+  }
+
+  stream(id) {
+    let stream = this.streams.get(id);
+    if (!stream) {
+      stream = { id, weight: 1, frames: [], bytes: 0, deficit: 0, list: null, waiter: null };
+      this.streams.set(id, stream);
+    }
+    return stream;
+  }
+
+  setWeight(id, weight) {
+    this.stream(id).weight = weight;
+  }
+
+  /**
+   * Queue a frame for a stream
+   * @param {number} bytes - What the frame counts for against the stream's share
+   * @param {boolean} last - Forget the stream once this frame has been sent
+   */
+  push(id, frame, bytes, last = false) {
+    if (this.stopped) {
+      return;
+    }
+    const stream = this.stream(id);
+    stream.frames.push({ frame, bytes, last });
+    stream.bytes += bytes;
+    if (stream.list === null) {
+      stream.deficit = this.chunkSize * stream.weight;
+      stream.list = this.newStreams;
+      this.newStreams.push(stream);
+    }
+    this.pump();
+  }
+
+  // Bytes queued for a stream
+  queued(id) {
+    const stream = this.streams.get(id);
+    return stream ? stream.bytes : 0;
+  }
+
+  // Call fn once no more than bytes are queued for a stream
+  whenBelow(id, bytes, fn) {
+    this.stream(id).waiter = { bytes, fn };
+  }
+
+  // Forget a stream, and what it has queued
+  drop(id) {
+    const stream = this.streams.get(id);
+    if (stream) {
+      this.unlist(stream);
+      this.streams.delete(id);
+    }
+  }
+
+  unlist(stream) {
+    if (stream.list) {
+      stream.list.splice(stream.list.indexOf(stream), 1);
+      stream.list = null;
+    }
+  }
+
+  pump() {
+    while (this.bufferedAmount() < this.highWater) {
+      const list = this.newStreams.length ? this.newStreams : this.oldStreams;
+      const stream = list[0];
+      if (!stream) {
+        return;
+      }
+
+      if (stream.frames.length === 0) {
+        // A new stream that ran dry goes to the end of the old ones first, so it cannot jump the queue again
+        // right away by sending a little at a time.
+        list.shift();
+        if (list === this.newStreams) {
+          stream.list = this.oldStreams;
+          this.oldStreams.push(stream);
+        } else {
+          stream.list = null;
+        }
+        continue;
+      }
+
+      if (stream.deficit <= 0) {
+        list.shift();
+        stream.deficit += this.chunkSize * stream.weight;
+        stream.list = this.oldStreams;
+        this.oldStreams.push(stream);
+        continue;
+      }
+
+      const { frame, bytes, last } = stream.frames.shift();
+      stream.bytes -= bytes;
+      stream.deficit -= bytes;
+      this.send(frame);
+
+      if (last) {
+        this.drop(stream.id);
+      } else if (stream.waiter && stream.bytes <= stream.waiter.bytes) {
+        const { fn } = stream.waiter;
+        stream.waiter = null;
+        fn();
+      }
+    }
+
+    // Held back: the owner pumps again once there is room
+    this.held();
+  }
+
+  stop() {
+    this.stopped = true;
+    this.streams.clear();
+    this.newStreams = [];
+    this.oldStreams = [];
+  }
+}
+
 /**
  * NetProxy - Browser client for WebSocket-to-TCP proxy
  *
@@ -11,10 +150,29 @@
  *     authToken: 'jwt-token-here'  // optional
  *   });
  *
- *   const connId = await proxy.open('example.com', 80);
+ *   const connId = await proxy.open('example.com', 80, { weight: 4 });  // weight optional, default 1
  *   proxy.write(connId, new Uint8Array([...]));
  *   proxy.onData(connId, (data) => console.log(data));
  *   proxy.close(connId);
+ *
+ *   // Or have the proxy make an HTTP request, the body arrives (decompressed) like data on a connection
+ *   const { id, status, headers } = await proxy.http('GET', 'https://example.com/', { 'User-Agent': 'x' });
+ *   proxy.onData(id, (data) => console.log(data));
+ *
+ * Connections share the WebSocket by weighted round robin, in both directions: options.chunkSize (default 16 KB) is
+ * what a connection of weight 1 sends per turn, options.highWaterBytes (default 64 KB) what may sit in the
+ * WebSocket's own buffer before the rest waits its turn.
+ *
+ * Where the browser and the proxy support it, WebTransport is used instead: every connection gets a QUIC stream of its
+ * own, so packet loss on one does not stall the others, and data goes unencoded. The proxy says where at /webtransport
+ * (next to the WebSocket), with the hash of its certificate if that is self-signed. If that fails, it is the
+ * WebSocket. options.transport: 'auto' (default), 'websocket' or 'webtransport' (no fallback). On WebTransport, a
+ * connection's weight is its stream's sendOrder: streams with higher weights go first.
+ *
+ * If the WebSocket drops, connections stay open: NetProxy reconnects, after 0.5, 1, 2, ... seconds (at most
+ * options.maxReconnectAttempts times, default 6), and resumes its session with the proxy, which keeps the connections
+ * for a grace period. Each end keeps what it sent until the other acknowledges it, and sends again what the other
+ * missed, so data carries on where it broke off. Writes meanwhile wait. Only if that fails do connections close.
  */
 class NetProxy {
   constructor(wsUrl, options = {}) {
@@ -27,14 +185,29 @@ class NetProxy {
     this.connected = false;
     this.connectPromise = null;
     this.reconnectAttempts = 0;
-    this.maxReconnectAttempts = 3;
+    this.maxReconnectAttempts = options.maxReconnectAttempts || 6;
+    this.reconnecting = false;
+    this.session = null;             // { token } of our session with the proxy, on the WebSocket
+    this.sent = 0;                   // Messages sent in the session, counted (see ResumableSocket in the proxy)
+    this.received = 0;               // Messages received, counted
+    this.replay = [];                // Sent and not acknowledged, oldest first
+    this.replayed = 0;               // Their bytes
+    this.unacked = 0;                // Bytes received since we last acknowledged
+    this.ackTimer = null;
+    this.scheduler = null;
+    this.transport = null;           // 'websocket' or 'webtransport', once connected
+    this.wt = null;                  // WebTransport session
+    this.control = null;             // Writer of its control stream
+    this.dataStreams = new Map();    // connId -> { stream, writer }, on WebTransport
+    this.webTransportFailed = false; // Not tried again once it failed
+    this.encoder = new TextEncoder();
   }
 
   /**
-   * Ensure WebSocket is connected
+   * Ensure we are connected to the proxy
    */
   async ensureConnected() {
-    if (this.connected && this.ws && this.ws.readyState === WebSocket.OPEN) {
+    if (this.connected) {
       return;
     }
 
@@ -42,62 +215,494 @@ class NetProxy {
       return this.connectPromise;
     }
 
-    this.connectPromise = new Promise((resolve, reject) => {
-      // Build URL with auth token if provided
-      let url = this.wsUrl;
-      if (this.options.authToken) {
-        const separator = url.includes('?') ? '&' : '?';
-        url = `${url}${separator}token=${encodeURIComponent(this.options.authToken)}`;
+    this.connectPromise = this.connect().finally(() => {
+      this.connectPromise = null;
+    });
+    return this.connectPromise;
+  }
+
+  /**
+   * Connect by WebTransport if we can, by WebSocket otherwise
+   */
+  async connect() {
+    const mode = this.options.transport || 'auto';
+    if (mode !== 'websocket' && !this.webTransportFailed && typeof WebTransport !== 'undefined') {
+      try {
+        await this.connectWebTransport();
+        return;
+      } catch (err) {
+        if (mode === 'webtransport') {
+          throw err;
+        }
+        this.webTransportFailed = true;
+        console.log('[NetProxy] WebTransport not available, using the WebSocket:', err.message);
       }
+    }
+    await this.connectWebSocket();
+  }
 
-      this.ws = new WebSocket(url);
+  async connectWebTransport() {
+    const timeout = this.options.webTransportTimeout || 3000;
 
-      this.ws.onopen = () => {
-        this.connected = true;
-        this.connectPromise = null;
-        this.reconnectAttempts = 0;
-        console.log('[NetProxy] Connected to', this.wsUrl);
-        resolve();
-      };
+    // Where the proxy serves WebTransport, if it does
+    const infoUrl = new URL('/webtransport', this.wsUrl.replace(/^ws/, 'http'));
+    const response = await fetch(infoUrl, { signal: AbortSignal.timeout(timeout) });
+    const info = response.ok ? await response.json() : {};
+    if (!info.url) {
+      throw new Error('Not offered by the proxy');
+    }
 
-      this.ws.onerror = (err) => {
-        this.connected = false;
-        this.connectPromise = null;
+    // A self-signed certificate, checked by the hash the proxy gave (over the same connection as the WebSocket's)
+    const wtOptions = {};
+    if (info.certificateHashes) {
+      wtOptions.serverCertificateHashes = info.certificateHashes.map((hash) => ({
+        algorithm: 'sha-256',
+        value: this.base64ToUint8Array(hash),
+      }));
+    }
+
+    // UDP may well be blocked on the way, which shows as no answer
+    const wt = new WebTransport(info.url, wtOptions);
+    let timer;
+    let lines;
+    let control;
+    try {
+      await Promise.race([
+        (async () => {
+          await wt.ready;
+          const stream = await wt.createBidirectionalStream();
+          control = stream.writable.getWriter();
+          control.write(this.encoder.encode(JSON.stringify({ t: 'hello', token: this.options.authToken }) + '\n'));
+
+          lines = this.readLines(stream.readable);
+          const first = await lines.next();
+          if (first.done || JSON.parse(first.value).t !== 'ready') {
+            throw new Error('Refused by the proxy');
+          }
+        })(),
+        wt.closed.then(() => {
+          throw new Error('Refused by the proxy');
+        }),
+        new Promise((resolve, reject) => {
+          timer = setTimeout(() => reject(new Error('No answer')), timeout);
+        }),
+      ]);
+    } catch (err) {
+      try {
+        wt.close();
+      } catch (e) {
+        // Already closed
+      }
+      throw err;
+    } finally {
+      clearTimeout(timer);
+    }
+
+    this.wt = wt;
+    this.control = control;
+    this.scheduler = null;
+    this.transport = 'webtransport';
+    this.connected = true;
+    this.reconnectAttempts = 0;
+    console.log('[NetProxy] Connected to', info.url, 'by WebTransport');
+
+    (async () => {
+      for await (const line of lines) {
+        try {
+          this.handleMessage(JSON.parse(line));
+        } catch (err) {
+          console.error('[NetProxy] Failed to parse message:', err);
+        }
+      }
+    })().catch(() => {});
+
+    wt.closed.catch(() => {}).then(() => {
+      if (this.wt === wt) {
+        console.log('[NetProxy] WebTransport session closed');
+        this.handleDisconnect();
+      }
+    });
+  }
+
+  /**
+   * Open a WebSocket, for a new session or to resume ours. Done once the proxy has said which it is.
+   */
+  connectWebSocket(resume = false) {
+    return new Promise((resolve, reject) => {
+      // Build URL with auth token if provided, and the session
+      const params = [];
+      if (this.options.authToken) {
+        params.push(`token=${encodeURIComponent(this.options.authToken)}`);
+      }
+      params.push(resume ? `session=${encodeURIComponent(this.session.token)}&received=${this.received}` : 'session=new');
+      const url = this.wsUrl + (this.wsUrl.includes('?') ? '&' : '?') + params.join('&');
+
+      const ws = new WebSocket(url);
+      ws.binaryType = 'arraybuffer';
+      this.ws = ws;
+      if (!resume) {
+        this.startSession();
+      }
+
+      ws.onerror = (err) => {
         console.error('[NetProxy] WebSocket error:', err);
         reject(new Error('WebSocket connection failed'));
       };
 
-      this.ws.onclose = (event) => {
-        this.connected = false;
-        this.connectPromise = null;
+      ws.onclose = (event) => {
+        reject(new Error('WebSocket closed'));
+        if (this.ws !== ws) {
+          return;
+        }
         console.log('[NetProxy] Disconnected:', event.code, event.reason);
-
-        // Notify all connections of close
-        for (const [connId, conn] of this.connections) {
-          conn.closed = true;
-          if (conn.onClose) {
-            conn.onClose();
-          }
+        this.connected = false;
+        if (this.reconnecting) {
+          return;  // The next attempt is up to reconnect()
         }
-        this.connections.clear();
-
-        // Reject pending opens
-        for (const [connId, pending] of this.pendingOpens) {
-          pending.reject(new Error('WebSocket closed'));
+        if (this.session && event.code !== 4001) {
+          this.reconnect();
+        } else {
+          this.handleDisconnect();
         }
-        this.pendingOpens.clear();
       };
 
-      this.ws.onmessage = (event) => {
+      ws.onmessage = (event) => {
         try {
-          this.handleMessage(JSON.parse(event.data));
+          if (event.data instanceof ArrayBuffer) {
+            this.noteReceived(event.data.byteLength);
+            this.handleBinary(event.data);
+            return;
+          }
+
+          const msg = JSON.parse(event.data);
+          if (msg.t === 'ack') {
+            this.ack(msg.n);
+            this.scheduler.pump();  // Room in the replay buffer
+          } else if (msg.t === 'session') {
+            this.handleSession(msg);
+            resolve();
+          } else {
+            this.noteReceived(event.data.length);
+            this.handleMessage(msg);
+          }
         } catch (err) {
           console.error('[NetProxy] Failed to parse message:', err);
         }
       };
     });
+  }
 
-    return this.connectPromise;
+  /**
+   * A new session: nothing counted or kept yet, and a fresh scheduler
+   */
+  startSession() {
+    if (this.scheduler) {
+      this.scheduler.stop();
+    }
+    this.sent = 0;
+    this.received = 0;
+    this.replay = [];
+    this.replayed = 0;
+    this.unacked = 0;
+    clearTimeout(this.ackTimer);
+    this.ackTimer = null;
+    let timer = null;
+    const scheduler = new StreamScheduler({
+      chunkSize: this.options.chunkSize || 16384,
+      highWater: this.options.highWaterBytes || 65536,
+      send: (frame) => this.sendFrame(frame),
+      // Held back while reconnecting, or while too much waits to be acknowledged
+      bufferedAmount: () => this.canSend() ? this.ws.bufferedAmount : Infinity,
+      held: () => {
+        // A browser WebSocket does not say when it has drained, so look again shortly. Reconnecting or waiting for
+        // acknowledgements, handleSession() and each {t: 'ack'} pump again.
+        if (this.canSend() && !timer) {
+          timer = setTimeout(() => {
+            timer = null;
+            scheduler.pump();
+          }, 5);
+        }
+      },
+    });
+    this.scheduler = scheduler;
+  }
+
+  // Frames can go out now: connected, and not too much waiting to be acknowledged
+  canSend() {
+    return this.connected && this.replayed < (this.options.replayBytes || 1048576);
+  }
+
+  /**
+   * The proxy's first word on a WebSocket: our session resumed, or a new one (and if we had one, it expired, and its
+   * connections with it)
+   */
+  handleSession(msg) {
+    if (!msg.resumed && this.session) {
+      console.log('[NetProxy] Session expired, connections closed');
+      this.handleDisconnect();
+      this.startSession();
+    }
+
+    this.session = { token: msg.token };
+    this.transport = 'websocket';
+    this.connected = true;
+    this.reconnectAttempts = 0;
+
+    if (msg.resumed) {
+      // What the proxy missed, then the rest
+      this.ack(msg.received);
+      for (const frame of this.replay) {
+        this.writeFrame(frame);
+      }
+      this.scheduler.pump();
+      console.log('[NetProxy] Session resumed on', this.wsUrl);
+    } else {
+      console.log('[NetProxy] Connected to', this.wsUrl);
+    }
+  }
+
+  /**
+   * The WebSocket dropped: resume the session on a new one, backing off exponentially between attempts. Until then,
+   * ensureConnected() waits for this.
+   */
+  reconnect() {
+    this.reconnecting = true;
+    this.connectPromise = (async () => {
+      while (this.reconnectAttempts < this.maxReconnectAttempts) {
+        const delay = 500 * 2 ** this.reconnectAttempts++;
+        await new Promise((resolve) => setTimeout(resolve, delay * (0.75 + Math.random() / 2)));
+        if (!this.session) {
+          return;  // disconnect() meanwhile
+        }
+        try {
+          await this.connectWebSocket(true);
+          return;
+        } catch (err) {
+          console.log(`[NetProxy] Reconnect attempt ${this.reconnectAttempts} failed`);
+        }
+      }
+      this.handleDisconnect();
+      throw new Error('Connection to the proxy lost');
+    })().finally(() => {
+      this.reconnecting = false;
+      this.connectPromise = null;
+    });
+    this.connectPromise.catch(() => {});
+  }
+
+  /**
+   * Send a message (or data frame, { id, data }) in the session: counted and kept until acknowledged
+   */
+  sendFrame(frame) {
+    this.sent++;
+    this.replay.push(frame);
+    this.replayed += frame.length !== undefined ? frame.length : frame.data.length;
+    this.writeFrame(frame);
+  }
+
+  writeFrame(frame) {
+    if (this.connected && this.ws.readyState === WebSocket.OPEN) {
+      this.ws.send(typeof frame === 'string' ? frame : this.binaryFrame(frame.id, frame.data));
+    }
+  }
+
+  // The proxy has received n messages, they need not be kept
+  ack(n) {
+    for (let i = n - (this.sent - this.replay.length); i > 0 && this.replay.length; i--) {
+      const frame = this.replay.shift();
+      this.replayed -= frame.length !== undefined ? frame.length : frame.data.length;
+    }
+  }
+
+  // A message has arrived, acknowledge it every 64 KB or 100 ms
+  noteReceived(bytes) {
+    this.received++;
+    this.unacked += bytes;
+    if (this.unacked >= 65536) {
+      this.sendAck();
+    } else if (!this.ackTimer) {
+      this.ackTimer = setTimeout(() => this.sendAck(), 100);
+    }
+  }
+
+  sendAck() {
+    clearTimeout(this.ackTimer);
+    this.ackTimer = null;
+    this.unacked = 0;
+    if (this.connected && this.ws.readyState === WebSocket.OPEN) {
+      this.ws.send(JSON.stringify({ t: 'ack', n: this.received }));
+    }
+  }
+
+  /**
+   * The WebSocket or WebTransport session is gone, and every connection with it
+   */
+  handleDisconnect() {
+    this.connected = false;
+    this.session = null;
+    clearTimeout(this.ackTimer);
+    this.ackTimer = null;
+    if (this.scheduler) {
+      this.scheduler.stop();
+    }
+    this.wt = null;
+    this.dataStreams.clear();
+
+    // Notify all connections of close
+    for (const [connId, conn] of this.connections) {
+      conn.closed = true;
+      if (conn.onClose) {
+        conn.onClose();
+      }
+    }
+    this.connections.clear();
+
+    // Reject pending opens
+    for (const [connId, pending] of this.pendingOpens) {
+      pending.reject(new Error('Connection to the proxy closed'));
+    }
+    this.pendingOpens.clear();
+  }
+
+  /**
+   * Send a control message
+   */
+  send(msg) {
+    if (this.transport === 'webtransport') {
+      this.control.write(this.encoder.encode(JSON.stringify(msg) + '\n')).catch(() => {});
+    } else {
+      this.sendFrame(JSON.stringify(msg));
+    }
+  }
+
+  /**
+   * Lines of text from a stream of bytes
+   */
+  async *readLines(readable) {
+    const reader = readable.getReader();
+    const decoder = new TextDecoder();
+    let text = '';
+    for (;;) {
+      const { done, value } = await reader.read();
+      if (done) {
+        return;
+      }
+      text += decoder.decode(value, { stream: true });
+      let newline;
+      while ((newline = text.indexOf('\n')) >= 0) {
+        yield text.slice(0, newline);
+        text = text.slice(newline + 1);
+      }
+    }
+  }
+
+  /**
+   * On WebTransport, open a connection's stream, which starts with its ID
+   */
+  async openStream(connId, weight) {
+    const stream = await this.wt.createBidirectionalStream(weight ? { sendOrder: weight } : {});
+    const writer = stream.writable.getWriter();
+    const header = new Uint8Array(4);
+    new DataView(header.buffer).setUint32(0, connId);
+    writer.write(header).catch(() => {});
+    this.dataStreams.set(connId, { stream, writer });
+  }
+
+  /**
+   * On WebTransport, once the proxy has answered an open() or http(): read the connection's stream if it was opened,
+   * or give up the stream. The end of the stream is the end of the connection.
+   */
+  streamOpened(connId, answer) {
+    if (!this.dataStreams.has(connId)) {
+      return answer;
+    }
+    return answer.then((result) => {
+      this.readStream(connId);
+      return result;
+    }, (err) => {
+      this.closeStream(connId);
+      throw err;
+    });
+  }
+
+  async readStream(connId) {
+    const reader = this.dataStreams.get(connId).stream.readable.getReader();
+    try {
+      for (;;) {
+        const { done, value } = await reader.read();
+        if (done) {
+          break;
+        }
+        this.receive(connId, value);
+      }
+    } catch (err) {
+      // Reset, the session is probably going
+    }
+
+    const conn = this.connections.get(connId);
+    if (conn && !conn.closed) {
+      conn.closed = true;
+      if (conn.onClose) {
+        conn.onClose();
+      }
+    }
+  }
+
+  closeStream(connId) {
+    const entry = this.dataStreams.get(connId);
+    if (entry) {
+      this.dataStreams.delete(connId);
+      entry.writer.close().catch(() => {});
+    }
+  }
+
+  /**
+   * A binary message for data on a connection: a 4-byte big-endian connection ID, then the data. Built in the same
+   * buffer every time, send() copies it.
+   */
+  binaryFrame(connId, data) {
+    if (!this.frameBuffer || this.frameBuffer.length < 4 + data.length) {
+      this.frameBuffer = new Uint8Array(4 + Math.max(data.length, this.scheduler.chunkSize));
+    }
+    new DataView(this.frameBuffer.buffer).setUint32(0, connId);
+    this.frameBuffer.set(data, 4);
+    return this.frameBuffer.subarray(0, 4 + data.length);
+  }
+
+  /**
+   * Handle incoming binary WebSocket message: a 4-byte big-endian connection ID, then data
+   */
+  handleBinary(buffer) {
+    const id = new DataView(buffer).getUint32(0);
+    this.receive(id, new Uint8Array(buffer, 4));
+  }
+
+  /**
+   * Hand data for a connection to its callback, or buffer it
+   */
+  receive(connId, data) {
+    const conn = this.connections.get(connId);
+    if (conn) {
+      if (conn.onData) {
+        conn.onData(data);
+      } else {
+        conn.buffer.push(data);
+      }
+    }
+  }
+
+  /**
+   * Start tracking a connection whose open() or http() succeeded
+   */
+  addConnection(connId) {
+    this.connections.set(connId, {
+      buffer: [],
+      closed: false,
+      error: null,
+      onData: null,
+      onClose: null,
+      onError: null,
+    });
   }
 
   /**
@@ -109,32 +714,27 @@ class NetProxy {
         const pending = this.pendingOpens.get(msg.id);
         if (pending) {
           this.pendingOpens.delete(msg.id);
-          this.connections.set(msg.id, {
-            buffer: [],
-            closed: false,
-            error: null,
-            onData: null,
-            onClose: null,
-            onError: null,
-          });
+          this.addConnection(msg.id);
           pending.resolve(msg.id);
         }
         break;
       }
 
-      case 'data': {
-        const conn = this.connections.get(msg.id);
-        if (conn) {
-          const data = this.base64ToUint8Array(msg.b64);
-          if (conn.onData) {
-            conn.onData(data);
-          } else {
-            conn.buffer.push(data);
-          }
+      case 'response': {
+        const pending = this.pendingOpens.get(msg.id);
+        if (pending) {
+          this.pendingOpens.delete(msg.id);
+          this.addConnection(msg.id);
+          pending.resolve({ id: msg.id, status: msg.status, headers: msg.headers });
         }
         break;
       }
 
+      case 'data': {
+        this.receive(msg.id, this.base64ToUint8Array(msg.b64));
+        break;
+      }
+
       case 'closed': {
         const conn = this.connections.get(msg.id);
         if (conn) {
@@ -151,6 +751,9 @@ class NetProxy {
         const pending = this.pendingOpens.get(msg.id);
         if (pending) {
           this.pendingOpens.delete(msg.id);
+          if (this.scheduler) {
+            this.scheduler.drop(msg.id);
+          }
           pending.reject(new Error(msg.msg));
         } else {
           const conn = this.connections.get(msg.id);
@@ -170,22 +773,29 @@ class NetProxy {
    * Open a new TCP connection through the proxy
    * @param {string} host - Target hostname
    * @param {number} port - Target port (must be in allowlist: 80, 443)
+   * @param {object} options - weight: share of the WebSocket relative to other connections (1 to 16, default 1)
    * @returns {Promise<number>} - Connection ID
    */
-  async open(host, port) {
+  async open(host, port, options = {}) {
     await this.ensureConnected();
 
     const id = this.nextConnId++;
+    if (this.transport === 'webtransport') {
+      await this.openStream(id, options.weight);
+    } else if (options.weight) {
+      this.scheduler.setWeight(id, options.weight);
+    }
 
-    return new Promise((resolve, reject) => {
+    return this.streamOpened(id, new Promise((resolve, reject) => {
       this.pendingOpens.set(id, { resolve, reject });
 
-      this.ws.send(JSON.stringify({
+      this.send({
         t: 'open',
         id,
         host,
         port,
-      }));
+        weight: options.weight,
+      });
 
       // Timeout after 30 seconds
       setTimeout(() => {
@@ -194,11 +804,54 @@ class NetProxy {
           reject(new Error('Connection timeout'));
         }
       }, 30000);
-    });
+    }));
+  }
+
+  /**
+   * Have the proxy make an HTTP request (following redirects)
+   *
+   * The response body then arrives as data on the returned ID, decompressed, and the ID closes at its end. Use
+   * onData(), readBuffered() and close() on it like on a connection.
+   * @param {string} method - GET or HEAD
+   * @param {string} url - http:// or https:// URL (port must be in the allowlist)
+   * @param {object} headers - Request headers (Host and transfer related ones are up to the proxy)
+   * @param {object} options - weight, as for open()
+   * @returns {Promise<{id: number, status: number, headers: object}>}
+   */
+  async http(method, url, headers = {}, options = {}) {
+    await this.ensureConnected();
+
+    const id = this.nextConnId++;
+    if (this.transport === 'webtransport') {
+      await this.openStream(id, options.weight);
+    }
+
+    return this.streamOpened(id, new Promise((resolve, reject) => {
+      this.pendingOpens.set(id, { resolve, reject });
+
+      this.send({
+        t: 'http',
+        id,
+        method,
+        url,
+        headers,
+        weight: options.weight,
+      });
+
+      // Timeout after 30 seconds (redirects included)
+      setTimeout(() => {
+        if (this.pendingOpens.has(id)) {
+          this.pendingOpens.delete(id);
+          reject(new Error('Request timeout'));
+        }
+      }, 30000);
+    }));
   }
 
   /**
    * Write data to a connection
+   *
+   * data is queued as it is, not copied, so it must not be changed afterwards.
    * @param {number} connId - Connection ID from open()
    * @param {Uint8Array|string} data - Data to send
    */
@@ -212,13 +865,35 @@ class NetProxy {
       data = new TextEncoder().encode(data);
     }
 
-    const b64 = this.uint8ArrayToBase64(data);
+    // Straight onto the connection's stream
+    if (this.transport === 'webtransport') {
+      this.dataStreams.get(connId).writer.write(data).catch(() => {});
+      return;
+    }
 
-    this.ws.send(JSON.stringify({
-      t: 'write',
-      id: connId,
-      b64,
-    }));
+    // In chunks, for the scheduler to interleave with other connections' writes. Framed when sent (binaryFrame()).
+    const chunkSize = this.scheduler.chunkSize;
+    for (let offset = 0; offset < data.length; offset += chunkSize) {
+      const chunk = data.subarray(offset, offset + chunkSize);
+      this.scheduler.push(connId, { id: connId, data: chunk }, chunk.length);
+    }
+  }
+
+  /**
+   * Change a connection's share of the WebSocket, in both directions (on WebTransport, its stream's sendOrder)
+   * @param {number} connId - Connection ID
+   * @param {number} weight - 1 to 16, relative to other connections (default 1)
+   */
+  setPriority(connId, weight) {
+    if (!this.connections.has(connId)) {
+      return;
+    }
+    if (this.transport === 'webtransport') {
+      this.dataStreams.get(connId).stream.writable.sendOrder = weight;
+      return;
+    }
+    this.scheduler.setWeight(connId, weight);
+    this.send({ t: 'priority', id: connId, weight });
   }
 
   /**
@@ -281,10 +956,16 @@ class NetProxy {
       return;
     }
 
-    this.ws.send(JSON.stringify({
-      t: 'close',
-      id: connId,
-    }));
+    if (this.transport === 'webtransport') {
+      // The end of its stream, after what was written
+      this.closeStream(connId);
+    } else {
+      // After what is still queued for it
+      this.scheduler.push(connId, JSON.stringify({
+        t: 'close',
+        id: connId,
+      }), 0, true);
+    }
 
     this.connections.delete(connId);
   }
@@ -358,10 +1039,19 @@ class NetProxy {
    * Disconnect from proxy server
    */
   disconnect() {
+    this.session = null;  // Not to be resumed
+    if (this.scheduler) {
+      this.scheduler.stop();
+    }
     if (this.ws) {
       this.ws.close();
       this.ws = null;
     }
+    if (this.wt) {
+      this.wt.close();
+      this.wt = null;
+    }
+    this.dataStreams.clear();
     this.connected = false;
     this.connections.clear();
     this.pendingOpens.clear();
@@ -371,14 +1061,6 @@ class NetProxy {
   // Utility methods
   // =========================================================================
 
-  uint8ArrayToBase64(bytes) {
-    let binary = '';
-    for (let i = 0; i < bytes.length; i++) {
-      binary += String.fromCharCode(bytes[i]);
-    }
-    return btoa(binary);
-  }
-
   base64ToUint8Array(base64) {
     const binary = atob(base64);
     const bytes = new Uint8Array(binary.length);
@@ -0,0 +1,194 @@
+// vmlinux-cache.js - Cache Storage-backed vmlinux, so that repeat visits compile from a cached response
+// SPDX-License-Identifier: MIT
+
+'use strict';
+
+/**
+ * VmlinuxCache - Keep vmlinux in Cache Storage, keyed by its SHA-256 hash
+ *
+ * Engines that cache compiled code for cached responses (Chrome does, after the module has tiered up) can then skip
+ * compiling vmlinux on repeat visits. Compiling always streams, so the engine starts on baseline code and tiers up hot
+ * functions in the background.
+ *
+ * A warm load boots the cached vmlinux right away and checks the network copy in the background. If that has changed,
+ * it is stored for the next visit. An ETag, or else Last-Modified and Content-Length (both readable cross-origin,
+ * unlike ETag), identify the network copy without downloading it. From a server that sends neither, the check takes a
+ * full download, so it is done at most once a day and only stores what has a different hash.
+ *
+ * Usage:
+ *   const cache = new VmlinuxCache();
+ *   await cache.init();
+ *
+ *   const { module, bytes, hash, warm } = await cache.load(url);
+ */
+class VmlinuxCache {
+  constructor(cacheName = 'linux-wasm-vmlinux') {
+    this.cacheName = cacheName;
+    this.cache = null;
+    this.unversionedInterval = 24 * 60 * 60 * 1000;  // ms between checks of a network copy without a version
+  }
+
+  /**
+   * Hex encoded SHA-256 of a buffer
+   * @param {ArrayBuffer|Uint8Array} buffer
+   * @returns {Promise<string>}
+   */
+  static async hash(buffer) {
+    const digest = new Uint8Array(await crypto.subtle.digest('SHA-256', buffer));
+    return Array.from(digest, (byte) => byte.toString(16).padStart(2, '0')).join('');
+  }
+
+  /**
+   * Identifies the network copy of vmlinux without its body
+   * @param {Response} response
+   * @returns {string|null} Null if the server does not tell
+   */
+  static version(response) {
+    const etag = response.headers.get('ETag');
+    if (etag) {
+      return etag;
+    }
+    const modified = response.headers.get('Last-Modified');
+    const length = response.headers.get('Content-Length');
+    return modified && length ? modified + ';' + length : null;
+  }
+
+  /**
+   * Open the cache
+   * @returns {Promise<void>}
+   */
+  async init() {
+    this.cache = await caches.open(this.cacheName);
+  }
+
+  /**
+   * Where vmlinux with a hash is kept
+   * @param {string} url
+   * @param {string} hash
+   * @returns {string}
+   */
+  entryUrl(url, hash) {
+    return url + (url.includes('?') ? '&' : '?') + 'sha256=' + hash;
+  }
+
+  /**
+   * Fetch and compile vmlinux, from the cache if it has it
+   * @param {string} url - Where vmlinux is on the network
+   * @returns {Promise<{module: WebAssembly.Module, bytes: ArrayBuffer, hash: string, warm: boolean}>}
+   */
+  async load(url) {
+    const latest = await this.cache.match(url);
+    if (latest) {
+      const entry = await latest.json();
+      const hash = entry.hash;
+      const response = await this.cache.match(this.entryUrl(url, hash));
+      if (response) {
+        const [module, bytes] = await Promise.all([
+          WebAssembly.compileStreaming(response.clone()),
+          response.arrayBuffer(),
+        ]);
+
+        this.refresh(url, entry).catch((error) => console.warn('Failed to refresh vmlinux: ' + error.message));
+        return { module: module, bytes: bytes, hash: hash, warm: true };
+      }
+    }
+
+    const response = await fetch(url);
+    if (!response.ok) {
+      throw new Error('Failed to fetch vmlinux: ' + response.status);
+    }
+
+    const [module, bytes] = await Promise.all([
+      WebAssembly.compileStreaming(response.clone()),
+      response.arrayBuffer(),
+    ]);
+    const hash = await this.store(url, bytes, VmlinuxCache.version(response));
+    return { module: module, bytes: bytes, hash: hash, warm: false };
+  }
+
+  /**
+   * Store vmlinux as the latest one for a URL, dropping any other
+   * @param {string} url
+   * @param {ArrayBuffer} bytes
+   * @param {string|null} version - From VmlinuxCache.version()
+   * @param {string} [hash] - Of bytes, if already known
+   * @returns {Promise<string>} The hash it was stored under
+   */
+  async store(url, bytes, version, hash) {
+    hash = hash || await VmlinuxCache.hash(bytes);
+    const entry = this.entryUrl(url, hash);
+
+    await this.cache.put(entry, new Response(bytes, { headers: { 'Content-Type': 'application/wasm' } }));
+    await this.setLatest(url, hash, version);
+
+    // Cached requests have absolute URLs, url may be relative.
+    const keep = [entry, url].map((relative) => new URL(relative, location.href).href);
+    for (const request of await this.cache.keys()) {
+      if (!keep.includes(request.url)) {
+        await this.cache.delete(request);
+      }
+    }
+    return hash;
+  }
+
+  /**
+   * Record which cached vmlinux is the latest for a URL, and that it was checked just now
+   * @param {string} url
+   * @param {string} hash
+   * @param {string|null} version
+   * @returns {Promise<void>}
+   */
+  async setLatest(url, hash, version) {
+    await this.cache.put(url, new Response(JSON.stringify({ hash: hash, version: version, checked: Date.now() }), {
+      headers: { 'Content-Type': 'application/json' },
+    }));
+  }
+
+  /**
+   * Store the network copy of vmlinux for next time, if it differs from the cached one
+   * @param {string} url
+   * @param {{hash: string, version: string|null, checked: number}} latest - What the cache has for the URL
+   * @returns {Promise<void>}
+   */
+  async refresh(url, latest) {
+    // Without a version, only the body tells whether it changed.
+    if (!latest.version && Date.now() - (latest.checked || 0) < this.unversionedInterval) {
+      return;
+    }
+
+    // Revalidates against the HTTP cache, which usually still has it.
+    const response = await fetch(url, { cache: 'no-cache' });
+    if (!response.ok) {
+      throw new Error('HTTP ' + response.status);
+    }
+
+    const version = VmlinuxCache.version(response);
+    if (latest.version && version === latest.version) {
+      await response.body.cancel();
+      return;
+    }
+
+    const bytes = await response.arrayBuffer();
+    const hash = await VmlinuxCache.hash(bytes);
+    if (hash === latest.hash) {
+      await this.setLatest(url, hash, version);
+      return;
+    }
+    await this.store(url, bytes, version, hash);
+  }
+
+  /**
+   * Drop the cached vmlinux (forcing a cold load next time)
+   * @returns {Promise<void>}
+   */
+  async clear() {
+    for (const request of await this.cache.keys()) {
+      await this.cache.delete(request);
+    }
+  }
+}
+
+// Export for module systems
+if (typeof module !== 'undefined' && module.exports) {
+  module.exports = VmlinuxCache;
+}